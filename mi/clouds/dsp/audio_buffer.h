@@ -37,9 +37,11 @@
 #include "stmlib/utils/dsp.h"
 
 #include "clouds/dsp/mu_law.h"
+#include "clouds/dsp/simd.h"
 
 const int32_t kCrossFadeSize = 256;
 const int32_t kInterpolationTail = 8;
+const size_t kReadBatchSize = 4;
 
 namespace clouds {
 
@@ -277,6 +279,27 @@ class AudioBuffer {
     return ((((a * t) - b_neg) * t + c) * t + x0) * scale;
   }
   
+  // Reads kReadBatchSize consecutive samples, at the 16.16 fixed-point
+  // positions phase, phase + increment, ... relative to first. Same results
+  // as kReadBatchSize calls to Read<method>(), computed in parallel from the
+  // 16-bit buffer.
+  template<InterpolationMethod method>
+  inline void ReadBatch(
+      int32_t first,
+      int32_t phase,
+      int32_t increment,
+      float* out) const {
+    if (resolution == RESOLUTION_16_BIT) {
+      ReadBatch4<method == INTERPOLATION_HERMITE ? 3 : int32_t(method)>(
+          s16_, size_, first, phase, increment, out);
+    } else {
+      for (size_t i = 0; i < kReadBatchSize; ++i) {
+        out[i] = Read<method>(first + (phase >> 16), phase & 65535);
+        phase += increment;
+      }
+    }
+  }
+  
   inline int32_t size() const { return size_; }
   inline int32_t head() const { return write_head_; }
   
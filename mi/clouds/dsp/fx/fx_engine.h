@@ -36,6 +36,7 @@
 #include "stmlib/dsp/dsp.h"
 #include "stmlib/dsp/cosine_oscillator.h"
 #include "clouds/dsp/random_oscillator.h"
+#include "clouds/dsp/simd.h"
 
 namespace clouds {
 
@@ -307,6 +308,42 @@ class FxEngine {
       accumulator_ += x * scale;
     }
     
+    // Batched version of InterpolateHermite: reads n taps, at the given
+    // offsets from the given delay line bases, into taps[]. The reads do not
+    // depend on the accumulator, so all the taps of a sample can be evaluated
+    // together - as long as none of them overlaps a location written in
+    // between. The results are then accumulated, in order, with Tap().
+    template<int32_t n>
+    inline void InterpolateHermite(
+        const int32_t* bases,
+        const float* offsets,
+        float* taps) const {
+      STATIC_ASSERT(n % 4 == 0, batch_size_multiple_of_4);
+      float xm1[n], x0[n], x1[n], x2[n], t[n];
+      for (int32_t i = 0; i < n; ++i) {
+        float offset = offsets[i];
+        MAKE_INTEGRAL_FRACTIONAL(offset);
+        int32_t p = write_ptr_ + offset_integral + bases[i];
+        xm1[i] = DataType<format>::Decompress(buffer_[(p - 1) & MASK]);
+        x0[i] = DataType<format>::Decompress(buffer_[(p) & MASK]);
+        x1[i] = DataType<format>::Decompress(buffer_[(p + 1) & MASK]);
+        x2[i] = DataType<format>::Decompress(buffer_[(p + 2) & MASK]);
+        t[i] = offset_fractional;
+      }
+      int32_t i = 0;
+      for (; i + 8 <= n; i += 8) {
+        HermiteBatch8(&xm1[i], &x0[i], &x1[i], &x2[i], &t[i], &taps[i]);
+      }
+      for (; i < n; i += 4) {
+        HermiteBatch4(&xm1[i], &x0[i], &x1[i], &x2[i], &t[i], &taps[i]);
+      }
+    }
+
+    inline void Tap(float value, float scale) {
+      previous_read_ = value;
+      accumulator_ += value * scale;
+    }
+    
    private:
     float accumulator_;
     float previous_read_;
@@ -31,18 +31,61 @@
 
 #include "stmlib/stmlib.h"
 
+#include <cmath>
+
 #include "clouds/dsp/fx/fx_engine.h"
 #include "clouds/dsp/random_oscillator.h"
 
 namespace clouds {
 
+// The delay lengths, pitch-shifter window and modulation rates below were
+// tuned for the module's 32kHz codec. They are scaled by sr / 32kHz, and the
+// delay memory is laid out for up to kOliverbMaxScale times the original
+// lengths (96kHz).
+const float kOliverbReferenceSampleRate = 32000.0f;
+const int32_t kOliverbMaxScale = 3;
+
 class Oliverb {
  public:
   Oliverb() { }
   ~Oliverb() { }
 
-  void Init(uint16_t* buffer) {
-    engine_.Init(buffer);
+  enum {
+    kMemorySize = 65536
+  };
+
+  // Size in bytes of the delay memory for a storage format.
+  static inline size_t memory_size(Format format) {
+    return format == FORMAT_32_BIT
+        ? kMemorySize * sizeof(float)
+        : kMemorySize * sizeof(uint16_t);
+  }
+
+  // The delay lines are stored either as 16-bit integers, like on the module,
+  // or as floats (FORMAT_32_BIT), which skips the conversions and the
+  // quantization of the tails. buffer holds memory_size(format) bytes.
+  void Init(
+      void* buffer,
+      Format format,
+      float sr,
+      stmlib::RandomGenerator* random) {
+    format_ = format == FORMAT_32_BIT ? FORMAT_32_BIT : FORMAT_16_BIT;
+    scale_ = sr / kOliverbReferenceSampleRate;
+    CONSTRAIN(scale_, 0.25f, static_cast<float>(kOliverbMaxScale));
+    if (format_ == FORMAT_32_BIT) {
+      engine_32_.Init(static_cast<float*>(buffer));
+      engine_32_.SetLFOFrequency(LFO_1, 0.5f / sr);
+    } else {
+      engine_16_.Init(static_cast<uint16_t*>(buffer));
+      engine_16_.SetLFOFrequency(LFO_1, 0.5f / sr);
+    }
+    static const float kLengths[10] = {
+      113, 162, 241, 399, 1253, 1738, 3411, 1513, 1363, 4782
+    };
+    for (int i = 0; i < 10; ++i) {
+      length_[i] = kLengths[i] * scale_ - 1.0f;
+    }
+    size_smoothing_ = 1.0f - powf(1.0f - 0.01f, 1.0f / scale_);
     diffusion_ = 0.625f;
     size_ = 1.0f;
     mod_amount_ = 0.0f;
@@ -56,38 +99,143 @@ class Oliverb {
     ratio_ = 0.0f;
     pitch_shift_amount_ = 1.0f;
     level_ = 0.0f;
+    smooth_size_ = size_;
+    lp_decay_1_ = lp_decay_2_ = 0.0f;
+    hp_decay_1_ = hp_decay_2_ = 0.0f;
     for (int i=0; i<9; i++)
-      lfo_[i].Init();
+      lfo_[i].Init(random);
   }
 
   void Process(FloatFrame* in_out, size_t size) {
+    Process<2>(&in_out->l, &in_out->r, &in_out->l, &in_out->r, size);
+  }
+
+  void Process(const FloatFrame* in, FloatFrame* out, size_t size) {
+    Process<2>(&in->l, &in->r, &out->l, &out->r, size);
+  }
+
+  // Planar variant. The output can alias the input.
+  void Process(
+      const float* in_l,
+      const float* in_r,
+      float* out_l,
+      float* out_r,
+      size_t size) {
+    Process<1>(in_l, in_r, out_l, out_r, size);
+  }
+
+  inline void set_amount(float amount) {
+    amount_ = amount;
+  }
+
+  inline void set_input_gain(float input_gain) {
+    input_gain_ = input_gain;
+  }
+
+  inline void set_decay(float decay) {
+    decay_ = decay;
+  }
+
+  inline void set_diffusion(float diffusion) {
+    diffusion_ = diffusion;
+  }
+
+  // The damping filters are one-pole, their coefficients are converted so
+  // that the cutoff stays the same at any sample rate.
+  inline void set_lp(float lp) {
+    lp_ = scale_ == 1.0f ? lp : 1.0f - powf(1.0f - lp, 1.0f / scale_);
+  }
+
+  inline void set_hp(float hp) {
+    hp_ = scale_ == 1.0f ? hp : 1.0f - powf(1.0f - hp, 1.0f / scale_);
+  }
+
+  inline void set_size(float size) {
+    size_ = size;
+  }
+
+  inline void set_mod_amount(float mod_amount) {
+    mod_amount_ = mod_amount * scale_;
+  }
+
+  inline void set_mod_rate(float mod_rate) {
+    mod_rate_ = mod_rate;
+  }
+
+  inline void set_ratio(float ratio) {
+    ratio_ = ratio;
+  }
+
+  inline void set_pitch_shift_amount(float pitch_shift) {
+    pitch_shift_amount_ = pitch_shift;
+  }
+
+ private:
+  typedef FxEngine<kMemorySize, FORMAT_16_BIT> E16;
+  typedef FxEngine<kMemorySize, FORMAT_32_BIT> E32;
+
+  template<int stride>
+  void Process(
+      const float* in_l,
+      const float* in_r,
+      float* out_l,
+      float* out_r,
+      size_t size) {
+    if (format_ == FORMAT_32_BIT) {
+      Render<stride>(&engine_32_, in_l, in_r, out_l, out_r, size);
+    } else {
+      Render<stride>(&engine_16_, in_l, in_r, out_l, out_r, size);
+    }
+  }
+
+  template<int stride, typename E>
+  void Render(
+      E* engine,
+      const float* in_l,
+      const float* in_r,
+      float* out_l,
+      float* out_r,
+      size_t size) {
     // This is the Griesinger topology described in the Dattorro paper
     // (4 AP diffusers on the input, then a loop of 2x 2AP+1Delay).
     // Modulation is applied in the loop of the first diffuser AP for additional
     // smearing; and to the two long delays for a slow shimmer/chorus effect.
-    typedef E::Reserve<113,     /* ap1 */
-      E::Reserve<162,           /* ap2 */
-      E::Reserve<241,           /* ap3 */
-      E::Reserve<399,           /* ap4 */
-      E::Reserve<1253,          /* dap1a */
-      E::Reserve<1738,          /* dap1b */
-      E::Reserve<3411,          /* del1 */
-      E::Reserve<1513,          /* dap2a */
-      E::Reserve<1363,          /* dap2b */
-      E::Reserve<4782> > > > > > > > > > Memory; /* del2 */
-    E::DelayLine<Memory, 0> ap1;
-    E::DelayLine<Memory, 1> ap2;
-    E::DelayLine<Memory, 2> ap3;
-    E::DelayLine<Memory, 3> ap4;
-    E::DelayLine<Memory, 4> dap1a;
-    E::DelayLine<Memory, 5> dap1b;
-    E::DelayLine<Memory, 6> del1;
-    E::DelayLine<Memory, 7> dap2a;
-    E::DelayLine<Memory, 8> dap2b;
-    E::DelayLine<Memory, 9> del2;
-    E::Context c;
+    typedef typename E::template Reserve<113 * kOliverbMaxScale,     /* ap1 */
+      typename E::template Reserve<162 * kOliverbMaxScale,           /* ap2 */
+      typename E::template Reserve<241 * kOliverbMaxScale,           /* ap3 */
+      typename E::template Reserve<399 * kOliverbMaxScale,           /* ap4 */
+      typename E::template Reserve<1253 * kOliverbMaxScale,          /* dap1a */
+      typename E::template Reserve<1738 * kOliverbMaxScale,          /* dap1b */
+      typename E::template Reserve<3411 * kOliverbMaxScale,          /* del1 */
+      typename E::template Reserve<1513 * kOliverbMaxScale,          /* dap2a */
+      typename E::template Reserve<1363 * kOliverbMaxScale,          /* dap2b */
+      typename E::template Reserve<4782 * kOliverbMaxScale> > > > > > > > > > Memory; /* del2 */
+    typename E::template DelayLine<Memory, 0> ap1;
+    typename E::template DelayLine<Memory, 1> ap2;
+    typename E::template DelayLine<Memory, 2> ap3;
+    typename E::template DelayLine<Memory, 3> ap4;
+    typename E::template DelayLine<Memory, 4> dap1a;
+    typename E::template DelayLine<Memory, 5> dap1b;
+    typename E::template DelayLine<Memory, 6> del1;
+    typename E::template DelayLine<Memory, 7> dap2a;
+    typename E::template DelayLine<Memory, 8> dap2b;
+    typename E::template DelayLine<Memory, 9> del2;
+    typename E::Context c;
+
+    // Delay line of each tap of the batched reads below.
+    const int32_t bases[16] = {
+      ap1.base, ap2.base, ap3.base, ap4.base,
+      del2.base, del2.base, del2.base,
+      dap1a.base, dap1b.base, dap2a.base, dap2b.base,
+      ap1.base,
+      del1.base, del1.base, del1.base,
+      del1.base
+    };
 
     const float kap = diffusion_;
+    const float smear_offset = 10.0f * scale_;
+    const float smear_amplitude = 60.0f * scale_;
+    const int32_t smear_write = static_cast<int32_t>(100.0f * scale_);
 
     float lp_1 = lp_decay_1_;
     float lp_2 = lp_decay_2_;
@@ -98,19 +246,19 @@ class Oliverb {
     /* Set frequency of LFOs */
     float slope = mod_rate_ * mod_rate_;
     slope *= slope * slope;
-    slope /= 200.0f;
+    slope /= 200.0f * scale_;
     for (int i=0; i<9; i++)
       lfo_[i].set_slope(slope);
 
     while (size--) {
       float wet;
-      engine_.Start(&c);
+      engine->Start(&c);
 
       // Smooth parameters to avoid delay glitches
-      ONE_POLE(smooth_size_, size_, 0.01f);
+      ONE_POLE(smooth_size_, size_, size_smoothing_);
 
       // compute windowing info for the pitch shifter
-      float ps_size = 128.0f + (3410.0f - 128.0f) * smooth_size_;
+      float ps_size = (128.0f + (3410.0f - 128.0f) * smooth_size_) * scale_;
       phase_ += (1.0f - ratio_) / ps_size;
       if (phase_ >= 1.0f) phase_ -= 1.0f;
       if (phase_ <= 0.0f) phase_ += 1.0f;
@@ -120,75 +268,87 @@ class Oliverb {
       float half = phase + ps_size * 0.5f;
       if (half >= ps_size) half -= ps_size;
 
-#define INTERPOLATE_LFO(del, lfo, gain)                                 \
-      {                                                                 \
-        float offset = (del.length - 1) * smooth_size_;                 \
-        offset += lfo.Next() * mod_amount_;                      \
-        CONSTRAIN(offset, 1.0f, del.length - 1);                        \
-        c.InterpolateHermite(del, offset, gain);                        \
-      }
-
-#define INTERPOLATE(del, gain)                                          \
-      {                                                                 \
-        float offset = (del.length - 1) * smooth_size_;                 \
-        CONSTRAIN(offset, 1.0f, del.length - 1);                        \
-        c.InterpolateHermite(del, offset, gain);                        \
-      }
+      // All the tap positions are known at the start of the sample. The
+      // random LFOs are advanced in the order in which the taps are used.
+      float offsets[16];
+      offsets[0] = TapOffset(length_[0], &lfo_[1]);   /* ap1 */
+      offsets[1] = TapOffset(length_[1], &lfo_[2]);   /* ap2 */
+      offsets[2] = TapOffset(length_[2], &lfo_[3]);   /* ap3 */
+      offsets[3] = TapOffset(length_[3], &lfo_[4]);   /* ap4 */
+      offsets[4] = TapOffset(length_[9], &lfo_[5]);   /* del2 */
+      offsets[5] = phase;
+      offsets[6] = half;
+      offsets[7] = TapOffset(length_[4], &lfo_[6]);   /* dap1a */
+      offsets[8] = TapOffset(length_[5]);             /* dap1b */
+      offsets[12] = TapOffset(length_[6], &lfo_[7]);  /* del1 */
+      offsets[13] = phase;
+      offsets[14] = half;
+      offsets[9] = TapOffset(length_[7], &lfo_[8]);   /* dap2a */
+      offsets[10] = TapOffset(length_[8]);            /* dap2b */
+      offsets[11] = offsets[15] = 1.0f;               /* padding */
+      float taps[16];
 
       // Smear AP1 inside the loop.
-      c.Interpolate(ap1, 10.0f, LFO_1, 60.0f, 1.0f);
-      c.Write(ap1, 100, 0.0f);
+      c.Interpolate(ap1, smear_offset, LFO_1, smear_amplitude, 1.0f);
+      c.Write(ap1, smear_write, 0.0f);
+
+      // Only del1 is written before being read within a sample, all the other
+      // taps can be fetched at once.
+      c.template InterpolateHermite<12>(bases, &offsets[0], &taps[0]);
 
-      c.Read(in_out->l + in_out->r, input_gain_);
+      c.Read(*in_l + *in_r, input_gain_);
       // Diffuse through 4 allpasses.
-      INTERPOLATE_LFO(ap1, lfo_[1], kap);
+      c.Tap(taps[0], kap);
       c.WriteAllPass(ap1, -kap);
-      INTERPOLATE_LFO(ap2, lfo_[2], kap);
+      c.Tap(taps[1], kap);
       c.WriteAllPass(ap2, -kap);
-      INTERPOLATE_LFO(ap3, lfo_[3], kap);
+      c.Tap(taps[2], kap);
       c.WriteAllPass(ap3, -kap);
-      INTERPOLATE_LFO(ap4, lfo_[4], kap);
+      c.Tap(taps[3], kap);
       c.WriteAllPass(ap4, -kap);
 
       float apout;
       c.Write(apout);
 
-      INTERPOLATE_LFO(del2, lfo_[5], decay_ * (1.0f - pitch_shift_amount_));
+      c.Tap(taps[4], decay_ * (1.0f - pitch_shift_amount_));
       /* blend in the pitch shifted feedback */
-      c.InterpolateHermite(del2, phase, tri * decay_ * pitch_shift_amount_);
-      c.InterpolateHermite(del2, half, (1.0f - tri) * decay_ * pitch_shift_amount_);
+      c.Tap(taps[5], tri * decay_ * pitch_shift_amount_);
+      c.Tap(taps[6], (1.0f - tri) * decay_ * pitch_shift_amount_);
 
       c.Lp(lp_1, lp_);
       c.Hp(hp_1, hp_);
       c.SoftLimit();
-      INTERPOLATE_LFO(dap1a, lfo_[6], -kap);
+      c.Tap(taps[7], -kap);
       c.WriteAllPass(dap1a, kap);
-      INTERPOLATE(dap1b, kap);
+      c.Tap(taps[8], kap);
       c.WriteAllPass(dap1b, -kap);
       c.Write(del1, 2.0f);
       c.Write(wet, 0.0f);
-      //c.Write(in_out->l, 0.0f);
-      in_out->l += (wet - in_out->l) * amount;
+      *out_l = *in_l + (wet - *in_l) * amount;
+
+      c.template InterpolateHermite<4>(&bases[12], &offsets[12], &taps[12]);
 
       c.Load(apout);
 
-      INTERPOLATE_LFO(del1, lfo_[7], decay_ * (1.0f - pitch_shift_amount_));
+      c.Tap(taps[12], decay_ * (1.0f - pitch_shift_amount_));
       /* blend in the pitch shifted feedback */
-      c.InterpolateHermite(del1, phase, tri * decay_ * pitch_shift_amount_);
-      c.InterpolateHermite(del1, half, (1.0f - tri) * decay_ * pitch_shift_amount_);
+      c.Tap(taps[13], tri * decay_ * pitch_shift_amount_);
+      c.Tap(taps[14], (1.0f - tri) * decay_ * pitch_shift_amount_);
       c.Lp(lp_2, lp_);
       c.Hp(hp_2, hp_);
       c.SoftLimit();
-      INTERPOLATE_LFO(dap2a, lfo_[8], kap);
+      c.Tap(taps[9], kap);
       c.WriteAllPass(dap2a, -kap);
-      INTERPOLATE(dap2b, -kap);
+      c.Tap(taps[10], -kap);
       c.WriteAllPass(dap2b, kap);
       c.Write(del2, 2.0f);
       c.Write(wet, 0.0f);
-      //c.Write(in_out->r, 0.0f);
-      in_out->r += (wet - in_out->r) * amount;
+      *out_r = *in_r + (wet - *in_r) * amount;
 
-      ++in_out;
+      in_l += stride;
+      in_r += stride;
+      out_l += stride;
+      out_r += stride;
     }
 
     lp_decay_1_ = lp_1;
@@ -197,53 +357,22 @@ class Oliverb {
     hp_decay_2_ = hp_2;
   }
 
-  inline void set_amount(float amount) {
-    amount_ = amount;
+  inline float TapOffset(float length) const {
+    float offset = length * smooth_size_;
+    CONSTRAIN(offset, 1.0f, length);
+    return offset;
   }
 
-  inline void set_input_gain(float input_gain) {
-    input_gain_ = input_gain;
-  }
-
-  inline void set_decay(float decay) {
-    decay_ = decay;
-  }
-
-  inline void set_diffusion(float diffusion) {
-    diffusion_ = diffusion;
+  inline float TapOffset(float length, RandomOscillator* lfo) {
+    float offset = length * smooth_size_;
+    offset += lfo->Next() * mod_amount_;
+    CONSTRAIN(offset, 1.0f, length);
+    return offset;
   }
 
-  inline void set_lp(float lp) {
-    lp_ = lp;
-  }
-
-  inline void set_hp(float hp) {
-    hp_ = hp;
-  }
-
-  inline void set_size(float size) {
-    size_ = size;
-  }
-
-  inline void set_mod_amount(float mod_amount) {
-    mod_amount_ = mod_amount;
-  }
-
-  inline void set_mod_rate(float mod_rate) {
-    mod_rate_ = mod_rate;
-  }
-
-  inline void set_ratio(float ratio) {
-    ratio_ = ratio;
-  }
-
-  inline void set_pitch_shift_amount(float pitch_shift) {
-    pitch_shift_amount_ = pitch_shift;
-  }
-
- private:
-  typedef FxEngine<16384, FORMAT_16_BIT> E;
-  E engine_;
+  Format format_;
+  E16 engine_16_;
+  E32 engine_32_;
 
   float amount_;
   float input_gain_;
@@ -265,6 +394,10 @@ class Oliverb {
   float ratio_;
   float level_;
 
+  float scale_;
+  float size_smoothing_;
+  float length_[10];
+
   RandomOscillator lfo_[9];
 
   DISALLOW_COPY_AND_ASSIGN(Oliverb);
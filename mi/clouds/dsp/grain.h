@@ -31,9 +31,12 @@
 
 #include "stmlib/stmlib.h"
 
+#include <algorithm>
+
 #include "stmlib/dsp/dsp.h"
 
 #include "clouds/dsp/audio_buffer.h"
+#include "clouds/dsp/frame.h"
 
 #include "clouds/resources.h"
 
@@ -45,6 +48,166 @@ enum GrainQuality {
   GRAIN_QUALITY_HIGH
 };
 
+// Longest envelope that can be shared between grains. This is the largest
+// grain size in lut_grain_size.
+const int32_t kMaxSharedEnvelopeWidth = 16384;
+
+// Everything the envelope of a grain depends on.
+struct GrainEnvelopeShape {
+  int32_t width;
+  float smoothness;
+  float slope;
+  GrainQuality quality;
+  
+  inline bool operator==(const GrainEnvelopeShape& other) const {
+    return width == other.width && smoothness == other.smoothness &&
+        slope == other.slope && quality == other.quality;
+  }
+};
+
+// Renders up to size samples of an envelope, from *phase. When the envelope
+// ends, -1.0f is written instead of a gain, and rendering stops. Returns the
+// number of values written.
+template<bool use_lut_for_envelope, GrainQuality quality>
+inline size_t RenderGrainEnvelope(
+    float* destination,
+    size_t size,
+    float* phase_state,
+    float increment,
+    float smoothness,
+    float slope) {
+  float* start = destination;
+  float phase = *phase_state;
+  while (size--) {
+    float gain = phase;
+    gain = gain >= 1.0f ? 2.0f - gain : gain;
+    if (use_lut_for_envelope) {
+      if (quality == GRAIN_QUALITY_HIGH) {
+        float window = 0.0f;
+        window = stmlib::Interpolate(lut_window, gain, 4096.0f);
+        gain += smoothness * (window - gain);
+      }
+    } else {
+      if (quality >= GRAIN_QUALITY_MEDIUM) {
+        gain *= slope;
+        if (gain >= 1.0f) gain = 1.0f;
+      }
+    }
+    phase += increment;
+    if (phase >= 2.0f) {
+      *destination++ = -1.0f;
+      break;
+    }
+    *destination++ = gain;
+  }
+  *phase_state = phase;
+  return destination - start;
+}
+
+// Envelope of a grain, rendered once and read by all the grains with the
+// same shape. It is rendered on demand, as far as the oldest of these grains
+// has progressed, so a shape used by a single grain costs no more than
+// rendering its envelope in place. Since all grains start with the same
+// phase and phase increment, the gains are exactly those the grain would
+// have rendered.
+class GrainEnvelope {
+ public:
+  GrainEnvelope() { }
+  ~GrainEnvelope() { }
+  
+  void Init() {
+    shape_.width = -1;
+    num_users_ = 0;
+    last_used_ = 0;
+    std::fill(&values_[0], &values_[kSize], 0.0f);
+  }
+  
+  void Start(const GrainEnvelopeShape& shape) {
+    shape_ = shape;
+    phase_ = 0.0f;
+    phase_increment_ = 2.0f / static_cast<float>(shape.width);
+    num_rendered_ = 0;
+    done_ = false;
+  }
+  
+  // Returns the gains of samples [start, start + size) of the envelope.
+  inline const float* Read(int32_t start, size_t size) {
+    int32_t end = start + static_cast<int32_t>(size);
+    if (!done_ && end > num_rendered_) {
+      size_t n = end - num_rendered_;
+      float* destination = &values_[num_rendered_];
+      if (shape_.smoothness != 0.0f) {
+        if (shape_.quality == GRAIN_QUALITY_HIGH) {
+          n = Render<true, GRAIN_QUALITY_HIGH>(destination, n);
+        } else if (shape_.quality == GRAIN_QUALITY_MEDIUM) {
+          n = Render<true, GRAIN_QUALITY_MEDIUM>(destination, n);
+        } else {
+          n = Render<true, GRAIN_QUALITY_LOW>(destination, n);
+        }
+      } else {
+        if (shape_.quality == GRAIN_QUALITY_HIGH) {
+          n = Render<false, GRAIN_QUALITY_HIGH>(destination, n);
+        } else if (shape_.quality == GRAIN_QUALITY_MEDIUM) {
+          n = Render<false, GRAIN_QUALITY_MEDIUM>(destination, n);
+        } else {
+          n = Render<false, GRAIN_QUALITY_LOW>(destination, n);
+        }
+      }
+      num_rendered_ += n;
+      done_ = n && values_[num_rendered_ - 1] == -1.0f;
+      if (!done_ && num_rendered_ >= kMaxLength) {
+        // Rounding errors on the phase can only stretch the envelope by a
+        // few samples. This is a safety net.
+        values_[num_rendered_ - 1] = -1.0f;
+        done_ = true;
+      }
+    }
+    return &values_[start];
+  }
+  
+  inline void Acquire(uint32_t time) {
+    ++num_users_;
+    last_used_ = time;
+  }
+  
+  inline void Release() {
+    --num_users_;
+  }
+  
+  inline bool in_use() const { return num_users_ != 0; }
+  inline uint32_t last_used() const { return last_used_; }
+  inline const GrainEnvelopeShape& shape() const { return shape_; }
+  
+ private:
+  template<bool use_lut_for_envelope, GrainQuality quality>
+  size_t Render(float* destination, size_t size) {
+    return RenderGrainEnvelope<use_lut_for_envelope, quality>(
+        destination,
+        size,
+        &phase_,
+        phase_increment_,
+        shape_.smoothness,
+        shape_.slope);
+  }
+  
+  // The phase accumulates rounding errors: leave some room for an envelope
+  // slightly longer than its width. A grain that has not ended yet can read
+  // up to a block past the last sample rendered.
+  static const int32_t kMaxLength = kMaxSharedEnvelopeWidth + 64;
+  static const int32_t kSize = kMaxLength + kMaxBlockSize;
+  
+  GrainEnvelopeShape shape_;
+  float phase_;
+  float phase_increment_;
+  int32_t num_rendered_;
+  bool done_;
+  int32_t num_users_;
+  uint32_t last_used_;
+  float values_[kSize];
+  
+  DISALLOW_COPY_AND_ASSIGN(GrainEnvelope);
+};
+
 class Grain {
  public:
   Grain() { }
@@ -53,6 +216,8 @@ class Grain {
   void Init() {
     active_ = false;
     envelope_phase_ = 2.0f;
+    recommended_quality_ = GRAIN_QUALITY_LOW;
+    shared_envelope_ = NULL;
   }
 
   void Start(
@@ -83,45 +248,49 @@ class Grain {
     gain_l_ = gain_l;
     gain_r_ = gain_r;
     recommended_quality_ = recommended_quality;
+    shared_envelope_ = NULL;
+    envelope_index_ = 0;
+  }
+  
+  // Makes the grain read its envelope from a shared one, with the same shape.
+  inline void set_shared_envelope(GrainEnvelope* envelope) {
+    shared_envelope_ = envelope;
+  }
+  
+  inline GrainEnvelope* shared_envelope() const { return shared_envelope_; }
+  
+  // Renders the rest of the envelope itself, from where the shared one is.
+  inline void DetachSharedEnvelope() {
+    envelope_phase_ = static_cast<float>(envelope_index_) *
+        envelope_phase_increment_;
+    shared_envelope_ = NULL;
+  }
+  
+  inline GrainEnvelopeShape envelope_shape() const {
+    GrainEnvelopeShape shape;
+    shape.width = width_;
+    shape.smoothness = envelope_smoothness_;
+    shape.slope = envelope_slope_;
+    shape.quality = recommended_quality_;
+    return shape;
   }
   
   template<bool use_lut_for_envelope, GrainQuality quality>
   inline void RenderEnvelope(float* destination, size_t size) {
-    const float increment = envelope_phase_increment_;
-    const float smoothness = envelope_smoothness_;
-    const float slope = envelope_slope_;
-
-    float phase = envelope_phase_;
-    while (size--) {
-      float gain = phase;
-      gain = gain >= 1.0f ? 2.0f - gain : gain;
-      if (use_lut_for_envelope) {
-        if (quality == GRAIN_QUALITY_HIGH) {
-          float window = 0.0f;
-          window = stmlib::Interpolate(lut_window, gain, 4096.0f);
-          gain += smoothness * (window - gain);
-        }
-      } else {
-        if (quality >= GRAIN_QUALITY_MEDIUM) {
-          gain *= slope;
-          if (gain >= 1.0f) gain = 1.0f;
-        }
-      }
-      phase += increment;
-      if (phase >= 2.0f) {
-        *destination = -1.0f;
-        break;
-      }
-      *destination++ = gain;
-    }
-    envelope_phase_ = phase;
+    RenderGrainEnvelope<use_lut_for_envelope, quality>(
+        destination,
+        size,
+        &envelope_phase_,
+        envelope_phase_increment_,
+        envelope_smoothness_,
+        envelope_slope_);
   }
   
   template<int32_t num_channels, GrainQuality quality, Resolution resolution>
   inline void OverlapAdd(
       const AudioBuffer<resolution>* buffer,
       float* destination,
-      float* envelope,
+      float* envelope_buffer,
       size_t size) {
     if (!active_) {
       return;
@@ -135,11 +304,15 @@ class Grain {
       --pre_delay_;
     }
     
-    // Pre-render the envelope in one pass.
-    if (envelope_smoothness_ == 0.0f) {
-      RenderEnvelope<false, quality>(envelope, size);
+    // Pre-render the envelope in one pass, unless it is shared.
+    const float* envelope = envelope_buffer;
+    if (shared_envelope_) {
+      envelope = shared_envelope_->Read(envelope_index_, size);
+      envelope_index_ += size;
+    } else if (envelope_smoothness_ == 0.0f) {
+      RenderEnvelope<false, quality>(envelope_buffer, size);
     } else {
-      RenderEnvelope<true, quality>(envelope, size);
+      RenderEnvelope<true, quality>(envelope_buffer, size);
     }
     
     const int32_t phase_increment = phase_increment_;
@@ -147,6 +320,46 @@ class Grain {
     const float gain_l = gain_l_;
     const float gain_r = gain_r_;
     int32_t phase = phase_;
+    
+    // Render kReadBatchSize samples at a time, with the interpolation done in
+    // parallel. The last, partial batch - and the one in which the envelope
+    // ends - go through the scalar loop below, which does all the work when
+    // built with CLOUDS_SCALAR_GRAINS.
+#ifndef CLOUDS_SCALAR_GRAINS
+    while (size >= kReadBatchSize) {
+      bool done = false;
+      for (size_t i = 0; i < kReadBatchSize; ++i) {
+        done = done || envelope[i] == -1.0f;
+      }
+      if (done) {
+        break;
+      }
+      
+      float l[kReadBatchSize];
+      float r[kReadBatchSize];
+      buffer[0].template ReadBatch<InterpolationMethod(quality)>(
+          first_sample, phase, phase_increment, l);
+      if (num_channels == 2) {
+        buffer[1].template ReadBatch<InterpolationMethod(quality)>(
+            first_sample, phase, phase_increment, r);
+      }
+      phase += phase_increment * static_cast<int32_t>(kReadBatchSize);
+      for (size_t i = 0; i < kReadBatchSize; ++i) {
+        float gain = *envelope++;
+        l[i] *= gain;
+        if (num_channels == 1) {
+          *destination++ += l[i] * gain_l;
+          *destination++ += l[i] * gain_r;
+        } else if (num_channels == 2) {
+          r[i] *= gain;
+          *destination++ += l[i] * gain_l + r[i] * (1.0f - gain_r);
+          *destination++ += r[i] * gain_r + l[i] * (1.0f - gain_l);
+        }
+      }
+      size -= kReadBatchSize;
+    }
+#endif  // CLOUDS_SCALAR_GRAINS
+    
     while (size--) {
       int32_t sample_index = first_sample + (phase >> 16);
       
@@ -196,6 +409,9 @@ class Grain {
   bool active_;
   
   GrainQuality recommended_quality_;
+  
+  GrainEnvelope* shared_envelope_;
+  int32_t envelope_index_;
 
   DISALLOW_COPY_AND_ASSIGN(Grain);
 };
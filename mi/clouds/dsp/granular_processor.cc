@@ -44,23 +44,68 @@ using namespace stmlib;
 
 void GranularProcessor::Init(
     void* large_buffer, size_t large_buffer_size,
-    void* small_buffer, size_t small_buffer_size) {
+    void* small_buffer, size_t small_buffer_size,
+    void* reverb_buffer, Format reverb_format) {
   buffer_[0] = large_buffer;
   buffer_[1] = small_buffer;
   buffer_size_[0] = large_buffer_size;
   buffer_size_[1] = small_buffer_size;
+  reverb_buffer_ = reverb_buffer;
+  reverb_format_ = reverb_format;
+  random_seed_ = 0x21;
+  SeedRandomStreams();
   
   num_channels_ = 2;
   low_fidelity_ = false;
   bypass_ = false;
+  silence_ = false;
   sample_rate_ = DEFAULT_SAMPLE_RATE;
+  playback_mode_ = PLAYBACK_MODE_GRANULAR;
+  freeze_lp_ = 0.0f;
+  max_num_grains_ = 0;
+  defer_spectral_frames_ = false;
+  degradation_ = 0.0f;
   
   src_down_.Init();
   src_up_.Init();
+  low_fidelity_phase_ = LOW_FIDELITY_ALIGNED;
+  low_fidelity_carry_.l = low_fidelity_carry_.r = 0.0f;
+  
+  ResetFilters();
+  memset(fb_, 0, sizeof(fb_));
   
   previous_playback_mode_ = PLAYBACK_MODE_LAST;
   reset_buffers_ = true;
+  release_freeze_ = false;
+  requested_playback_mode_.store(playback_mode_, memory_order_relaxed);
+  requested_num_channels_.store(num_channels_, memory_order_relaxed);
+  requested_low_fidelity_.store(low_fidelity_, memory_order_relaxed);
+  requested_sample_rate_.store(sample_rate_, memory_order_relaxed);
+  reset_requested_.store(false, memory_order_relaxed);
+  requested_seed_.store(random_seed_, memory_order_relaxed);
+  requested_max_num_grains_.store(max_num_grains_, memory_order_relaxed);
+  prepare_state_.store(PREPARE_STATE_PENDING, memory_order_release);
   dry_wet_ = 0.0f;
+  parameter_queue_.Init();
+  num_pending_events_ = 0;
+}
+
+uint32_t GranularProcessor::stream_seed(int32_t stream) const {
+  // Scramble the seed (MurmurHash3's finalizer) so that the streams are far
+  // apart in the LCG's sequence.
+  uint32_t h = random_seed_ + 0x9e3779b9 * (stream + 1);
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+void GranularProcessor::SeedRandomStreams() {
+  for (int32_t i = 0; i < RANDOM_STREAM_LAST; ++i) {
+    random_[i].Seed(stream_seed(i));
+  }
 }
 
 void GranularProcessor::ResetFilters() {
@@ -105,6 +150,8 @@ void GranularProcessor::ProcessGranular(
       parameters_.granular.window_shape = parameters_.texture < 0.75f
           ? parameters_.texture * 1.333f : 1.0f;
 
+      player_.set_max_num_grains(num_grains());
+      player_.set_degradation(degradation_);
       if (resolution() == 8) {
         player_.Play(buffer_8_, parameters_, &output[0].l, size);
       } else {
@@ -160,8 +207,185 @@ void GranularProcessor::Process(
     FloatFrame* input,
     FloatFrame* output,
     size_t size) {
+  // Only the parameter changes queued so far belong to this vector.
+  num_pending_events_ = parameter_queue_.readable();
+  if (bypass_) {
+    ApplyParameterEvents(SIZE_MAX);
+    copy(&input[0], &input[size], &output[0]);
+    return;
+  }
+  
+  if (silence_ || !EnginesReady()) {
+    ApplyParameterEvents(SIZE_MAX);
+    fill(&output[0].l, &output[size].l, 0.0f);
+    return;
+  }
+
+  // Host vectors can be much larger than the internal scratch buffers. Slice
+  // them so that the working set stays in cache, and so that the smoothing of
+  // parameters happens at the same rate whatever the host vector size.
+  // Slices also end where queued parameter changes are due.
+  size_t time = 0;
+  while (size) {
+    size_t block_size = NextBlockSize(time, size);
+    ProcessBlock(input, output, block_size);
+    input += block_size;
+    output += block_size;
+    size -= block_size;
+    time += block_size;
+  }
+  // Changes due past the end of the vector are not carried over.
+  ApplyParameterEvents(SIZE_MAX);
+}
+
+void GranularProcessor::Process(
+    const float* input_l,
+    const float* input_r,
+    float* output_l,
+    float* output_r,
+    size_t size) {
+  num_pending_events_ = parameter_queue_.readable();
+  if (bypass_) {
+    ApplyParameterEvents(SIZE_MAX);
+    copy(&input_l[0], &input_l[size], &output_l[0]);
+    copy(&input_r[0], &input_r[size], &output_r[0]);
+    return;
+  }
+  
+  if (silence_ || !EnginesReady()) {
+    ApplyParameterEvents(SIZE_MAX);
+    fill(&output_l[0], &output_l[size], 0.0f);
+    fill(&output_r[0], &output_r[size], 0.0f);
+    return;
+  }
+
+  size_t time = 0;
+  while (size) {
+    size_t block_size = NextBlockSize(time, size);
+    ProcessBlock(input_l, input_r, output_l, output_r, block_size);
+    input_l += block_size;
+    input_r += block_size;
+    output_l += block_size;
+    output_r += block_size;
+    size -= block_size;
+    time += block_size;
+  }
+  // Changes due past the end of the vector are not carried over.
+  ApplyParameterEvents(SIZE_MAX);
+}
+
+void GranularProcessor::Process(
+    const double* input_l,
+    const double* input_r,
+    double* output_l,
+    double* output_r,
+    size_t size) {
+  num_pending_events_ = parameter_queue_.readable();
+  if (bypass_) {
+    ApplyParameterEvents(SIZE_MAX);
+    copy(&input_l[0], &input_l[size], &output_l[0]);
+    copy(&input_r[0], &input_r[size], &output_r[0]);
+    return;
+  }
+  
+  if (silence_ || !EnginesReady()) {
+    ApplyParameterEvents(SIZE_MAX);
+    fill(&output_l[0], &output_l[size], 0.0);
+    fill(&output_r[0], &output_r[size], 0.0);
+    return;
+  }
+
+  size_t time = 0;
+  while (size) {
+    size_t block_size = NextBlockSize(time, size);
+    copy(&input_l[0], &input_l[block_size], &planar_in_[0][0]);
+    copy(&input_r[0], &input_r[block_size], &planar_in_[1][0]);
+    ProcessBlock(
+        planar_in_[0], planar_in_[1],
+        planar_in_[0], planar_in_[1],
+        block_size);
+    copy(&planar_in_[0][0], &planar_in_[0][block_size], &output_l[0]);
+    copy(&planar_in_[1][0], &planar_in_[1][block_size], &output_r[0]);
+    input_l += block_size;
+    input_r += block_size;
+    output_l += block_size;
+    output_r += block_size;
+    size -= block_size;
+    time += block_size;
+  }
+  // Changes due past the end of the vector are not carried over.
+  ApplyParameterEvents(SIZE_MAX);
+}
+
+// Applies the pending parameter changes due at or before 'time'. Changes are
+// due on even samples, so that the slices stay whole in low fidelity mode.
+void GranularProcessor::ApplyParameterEvents(size_t time) {
+  while (num_pending_events_) {
+    const ParameterEvent& event = parameter_queue_.front();
+    size_t due = event.time & ~(kDownsamplingFactor - 1);
+    if (due > time) {
+      break;
+    }
+    ApplyParameterEvent(event, &parameters_);
+    parameter_queue_.Pop();
+    --num_pending_events_;
+  }
+}
+
+size_t GranularProcessor::NextBlockSize(size_t time, size_t size) {
+  ApplyParameterEvents(time);
+  size_t block_size = min(size, kMaxBlockSize);
+  if (num_pending_events_) {
+    size_t due = parameter_queue_.front().time & ~(kDownsamplingFactor - 1);
+    block_size = min(block_size, due - time);
+  }
+  return block_size;
+}
+
+// Slices are even unless the host vector is odd. Then a sample is carried
+// over to the next slice, and the output runs one sample late from there on:
+// the slot left empty by the first odd slice repeats the previous output.
+void GranularProcessor::ProcessLowFidelity(size_t size) {
+  size_t input_size = size;
+  if (low_fidelity_phase_ == LOW_FIDELITY_CARRY_INPUT) {
+    copy_backward(&in_[0], &in_[size], &in_[size + 1]);
+    in_[0] = low_fidelity_carry_;
+    ++input_size;
+  }
+  FloatFrame* output = out_;
+  if (low_fidelity_phase_ == LOW_FIDELITY_CARRY_OUTPUT) {
+    *output++ = low_fidelity_carry_;
+  }
+  size_t downsampled_size = input_size / kDownsamplingFactor;
+  if (downsampled_size) {
+    src_down_.Process(
+        in_, in_downsampled_, downsampled_size * kDownsamplingFactor);
+    ProcessGranular(in_downsampled_, out_downsampled_, downsampled_size);
+    src_up_.Process(out_downsampled_, output, downsampled_size);
+  }
+  size_t output_size = output - out_ + downsampled_size * kDownsamplingFactor;
+  if (output_size < size) {
+    out_[size - 1] = size > 1 ? out_[size - 2] : low_fidelity_carry_;
+  }
+
+  if (input_size & 1) {
+    low_fidelity_phase_ = LOW_FIDELITY_CARRY_INPUT;
+    low_fidelity_carry_ = in_[input_size - 1];
+  } else if (output_size > size) {
+    low_fidelity_phase_ = LOW_FIDELITY_CARRY_OUTPUT;
+    low_fidelity_carry_ = out_[size];
+  } else {
+    // Kept for the repeat, should an odd slice come next.
+    low_fidelity_phase_ = LOW_FIDELITY_ALIGNED;
+    low_fidelity_carry_ = out_[size - 1];
+  }
+}
 
+void GranularProcessor::ConfigureReverb() {
+  float feedback = parameters_.feedback;
   float reverb_amount = parameters_.reverb * 0.95f;
+  reverb_amount += feedback * (2.0f - feedback) * freeze_lp_;
+  CONSTRAIN(reverb_amount, 0.0f, 1.0f);
   
   oliverb_.set_amount(reverb_amount * 0.54f);
     // Settings of the reverb
@@ -195,23 +419,224 @@ void GranularProcessor::Process(
                                           // gets rid of
                                           // feedback of large
                                           // DC offset.
+}
 
-  copy(&input[0], &input[size], &out_[0]);
-  oliverb_.Process(out_, size);
-
+template<int stride, int wet_stride>
+void GranularProcessor::Mix(
+    const float* dry_l,
+    const float* dry_r,
+    const float* wet_l,
+    const float* wet_r,
+    float* output_l,
+    float* output_r,
+    size_t size) {
   const float post_gain = 1.2f;
   ParameterInterpolator dry_wet_mod(&dry_wet_, parameters_.dry_wet, size);
   for (size_t i = 0; i < size; ++i) {
     float dry_wet = dry_wet_mod.Next();
     float fade_in = Interpolate(lut_xfade_in, dry_wet, 16.0f);
     float fade_out = Interpolate(lut_xfade_out, dry_wet, 16.0f);
-    float l = input[i].l * fade_out;
-    float r = input[i].r * fade_out;
-    l += out_[i].l * post_gain * fade_in;
-    r += out_[i].r * post_gain * fade_in;
-    output[i].l = l;
-    output[i].r = r;
+    float l = dry_l[i * stride] * fade_out;
+    float r = dry_r[i * stride] * fade_out;
+    l += wet_l[i * wet_stride] * post_gain * fade_in;
+    r += wet_r[i * wet_stride] * post_gain * fade_in;
+    output_l[i * stride] = l;
+    output_r[i * stride] = r;
+  }
+}
+
+void GranularProcessor::ReportLoad(float load, size_t size) {
+  // Lower the quality quickly when the vector took too long, and restore it
+  // slowly once there is room again. The dead zone in between prevents the
+  // controller from toggling between two settings. The steps are per block,
+  // whatever the host vector size.
+  float blocks = static_cast<float>(size) / kMaxBlockSize;
+  if (load > 0.9f) {
+    degradation_ += 0.05f * blocks;
+  } else if (load < 0.6f) {
+    degradation_ -= 0.002f * blocks;
+  }
+  CONSTRAIN(degradation_, 0.0f, 1.0f);
+}
+
+void GranularProcessor::ProcessChain(size_t size) {
+  // Only the grains can be degraded.
+  if (playback_mode_ != PLAYBACK_MODE_GRANULAR) {
+    degradation_ = 0.0f;
+  }
+  
+  // In reverb-only mode, ProcessBlock() runs Oliverb straight from the
+  // input, without going through in_ and out_.
+  if (playback_mode_ != PLAYBACK_MODE_OLIVERB) {
+    // Mixdown for mono processing.
+    if (num_channels_ == 1) {
+      for (size_t i = 0; i < size; ++i) {
+        in_[i].l = (in_[i].l + in_[i].r) * 0.5f;
+        in_[i].r = in_[i].l;
+      }
+    }
+
+    // Apply feedback, with high-pass filtering to prevent build-ups at very
+    // low frequencies (causing large DC swings).
+    ONE_POLE(freeze_lp_, parameters_.freeze ? 1.0f : 0.0f, 0.0005f)
+    float feedback = parameters_.feedback;
+    float cutoff = (20.0f + 100.0f * feedback * feedback) / sample_rate();
+    fb_filter_[0].set_f_q<FREQUENCY_FAST>(cutoff, 1.0f);
+    fb_filter_[1].set(fb_filter_[0]);
+    fb_filter_[0].Process<FILTER_MODE_HIGH_PASS>(&fb_[0].l, &fb_[0].l, size, 2);
+    fb_filter_[1].Process<FILTER_MODE_HIGH_PASS>(&fb_[0].r, &fb_[0].r, size, 2);
+    float fb_gain = feedback * (1.0f - freeze_lp_);
+    for (size_t i = 0; i < size; ++i) {
+      in_[i].l += fb_gain * (
+          SoftLimit(fb_gain * 1.4f * fb_[i].l + in_[i].l) - in_[i].l);
+      in_[i].r += fb_gain * (
+          SoftLimit(fb_gain * 1.4f * fb_[i].r + in_[i].r) - in_[i].r);
+    }
+
+    if (low_fidelity_) {
+      ProcessLowFidelity(size);
+    } else {
+      ProcessGranular(in_, out_, size);
+    }
+    // A trigger is consumed by the block that received it.
+    parameters_.trigger = false;
+
+    // Diffusion and pitch-shifting post-processings.
+    if (playback_mode_ != PLAYBACK_MODE_SPECTRAL) {
+      float texture = parameters_.texture;
+      float diffusion = playback_mode_ == PLAYBACK_MODE_GRANULAR 
+          ? texture > 0.75f ? (texture - 0.75f) * 4.0f : 0.0f
+          : parameters_.density;
+      diffuser_.set_amount(diffusion);
+      diffuser_.Process(out_, size);
+    }
+
+    if (playback_mode_ == PLAYBACK_MODE_LOOPING_DELAY &&
+        (!parameters_.freeze || looper_.synchronized())) {
+      pitch_shifter_.set_ratio(SemitonesToRatio(parameters_.pitch));
+      pitch_shifter_.set_size(parameters_.size);
+      // Fade the shifter in away from unison, so that the loop plays clean
+      // at 0 semitones.
+      float x = parameters_.pitch;
+      const float limit = 0.7f;
+      const float slew = 0.4f;
+      float wet =
+        x < -limit ? 1.0f :
+        x < -limit + slew ? 1.0f - (x + limit) / slew:
+        x < limit - slew ? 0.0f :
+        x < limit ? 1.0f + (x - limit) / slew:
+        1.0f;
+      pitch_shifter_.set_dry_wet(wet);
+      pitch_shifter_.Process(out_, size);
+    }
+
+    // Apply filters.
+    if (playback_mode_ == PLAYBACK_MODE_LOOPING_DELAY ||
+        playback_mode_ == PLAYBACK_MODE_STRETCH) {
+      float cutoff = parameters_.texture;
+      float lp_cutoff = 0.5f * SemitonesToRatio(
+          (cutoff < 0.5f ? cutoff - 0.5f : 0.0f) * 216.0f);
+      float hp_cutoff = 0.25f * SemitonesToRatio(
+          (cutoff < 0.5f ? -0.5f : cutoff - 1.0f) * 216.0f);
+      CONSTRAIN(lp_cutoff, 0.0f, 0.499f);
+      CONSTRAIN(hp_cutoff, 0.0f, 0.499f);
+      float lpq = 1.0f + 3.0f * (1.0f - feedback) * (0.5f - lp_cutoff);
+      lp_filter_[0].set_f_q<FREQUENCY_FAST>(lp_cutoff, lpq);
+      lp_filter_[0].Process<FILTER_MODE_LOW_PASS>(
+          &out_[0].l, &out_[0].l, size, 2);
+
+      lp_filter_[1].set(lp_filter_[0]);
+      lp_filter_[1].Process<FILTER_MODE_LOW_PASS>(
+          &out_[0].r, &out_[0].r, size, 2);
+
+      hp_filter_[0].set_f_q<FREQUENCY_FAST>(hp_cutoff, 1.0f);
+      hp_filter_[0].Process<FILTER_MODE_HIGH_PASS>(
+          &out_[0].l, &out_[0].l, size, 2);
+
+      hp_filter_[1].set(hp_filter_[0]);
+      hp_filter_[1].Process<FILTER_MODE_HIGH_PASS>(
+          &out_[0].r, &out_[0].r, size, 2);
+    }
+
+    // This is what is fed back. Reverb is not fed back.
+    copy(&out_[0], &out_[size], &fb_[0]);
+  }
+
+  ConfigureReverb();
+  if (playback_mode_ != PLAYBACK_MODE_OLIVERB) {
+    oliverb_.Process(out_, size);
+  }
+
+  ProcessBackgroundTasks();
+}
+
+void GranularProcessor::ProcessBackgroundTasks() {
+  // The module runs these from its main loop, between audio interrupts. Here
+  // they run after every block: the FFTs of the spectral mode, and the
+  // search of the stretch mode's correlator.
+  if (playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
+    if (!defer_spectral_frames_) {
+      phase_vocoder_.Buffer();
+    }
+  } else if (playback_mode_ == PLAYBACK_MODE_STRETCH) {
+    if (resolution() == 8) {
+      ws_player_.LoadCorrelator(buffer_8_);
+    } else {
+      ws_player_.LoadCorrelator(buffer_16_);
+    }
+    correlator_.EvaluateSomeCandidates();
+  }
+}
+
+void GranularProcessor::ProcessBlock(
+    FloatFrame* input,
+    FloatFrame* output,
+    size_t size) {
+  if (playback_mode_ == PLAYBACK_MODE_OLIVERB) {
+    ProcessChain(size);
+    oliverb_.Process(input, out_, size);
+  } else {
+    copy(&input[0], &input[size], &in_[0]);
+    ProcessChain(size);
+  }
+  Mix<2, 2>(
+      &input[0].l, &input[0].r,
+      &out_[0].l, &out_[0].r,
+      &output[0].l, &output[0].r,
+      size);
+}
+
+void GranularProcessor::ProcessBlock(
+    const float* input_l,
+    const float* input_r,
+    float* output_l,
+    float* output_r,
+    size_t size) {
+  // The dry signal is read from the host buffers by the mix, which then
+  // writes to the output. The output may alias the input. In reverb-only
+  // mode, Oliverb reads the host buffers too, and renders into a planar
+  // scratch buffer.
+  if (playback_mode_ == PLAYBACK_MODE_OLIVERB) {
+    ProcessChain(size);
+    oliverb_.Process(
+        input_l, input_r, planar_wet_[0], planar_wet_[1], size);
+    Mix<1, 1>(
+        input_l, input_r,
+        planar_wet_[0], planar_wet_[1],
+        output_l, output_r,
+        size);
+    return;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    in_[i].l = input_l[i];
+    in_[i].r = input_r[i];
   }
+  ProcessChain(size);
+  Mix<1, 2>(
+      input_l, input_r,
+      &out_[0].l, &out_[0].r,
+      output_l, output_r,
+      size);
 }
 
 void GranularProcessor::PreparePersistentData() {
@@ -291,11 +716,66 @@ bool GranularProcessor::LoadPersistentData(const uint32_t* data) {
     buffer_16_[1].Resync(persistent_state_.write_head[1]);
   }
   parameters_.freeze = true;
+  release_freeze_ = false;
   silence_ = false;
   return true;
 }
 
+// Only called by the thread that owns the engines.
+void GranularProcessor::ApplyRequestedSettings() {
+  int32_t num_channels = requested_num_channels_.load(memory_order_relaxed);
+  bool low_fidelity = requested_low_fidelity_.load(memory_order_relaxed);
+  float sample_rate = requested_sample_rate_.load(memory_order_relaxed);
+  if (reset_requested_.exchange(false, memory_order_relaxed) ||
+      num_channels != num_channels_ ||
+      low_fidelity != low_fidelity_ ||
+      sample_rate != sample_rate_) {
+    reset_buffers_ = true;
+  }
+  num_channels_ = num_channels;
+  low_fidelity_ = low_fidelity;
+  sample_rate_ = sample_rate;
+  playback_mode_ = requested_playback_mode_.load(memory_order_relaxed);
+  max_num_grains_ = requested_max_num_grains_.load(memory_order_relaxed);
+  
+  uint32_t seed = requested_seed_.load(memory_order_relaxed);
+  if (seed != random_seed_) {
+    random_seed_ = seed;
+    for (int32_t i = 0; i < RANDOM_STREAM_LAST; ++i) {
+      if (i != RANDOM_STREAM_SPECTRAL) {
+        random_[i].Seed(stream_seed(i));
+      }
+    }
+    // The phase vocoder draws from its stream in Buffer(), which may be
+    // running on another thread: it reseeds it there.
+    phase_vocoder_.Reseed(stream_seed(RANDOM_STREAM_SPECTRAL));
+  }
+}
+
+bool GranularProcessor::EnginesReady() {
+  if (prepare_state_.load(memory_order_acquire) != PREPARE_STATE_READY) {
+    return false;
+  }
+  if (release_freeze_) {
+    parameters_.freeze = false;
+    release_freeze_ = false;
+  }
+  ApplyRequestedSettings();
+  if (reset_buffers_ || previous_playback_mode_ != playback_mode_) {
+    // Hand the engines over to Prepare(). From now on this thread won't touch
+    // them until Prepare() has published the new configuration.
+    prepare_state_.store(PREPARE_STATE_PENDING, memory_order_release);
+    return false;
+  }
+  return true;
+}
+
 void GranularProcessor::Prepare() {
+  if (prepare_state_.load(memory_order_acquire) != PREPARE_STATE_PENDING) {
+    return;
+  }
+  ApplyRequestedSettings();
+
   bool playback_mode_changed = previous_playback_mode_ != playback_mode_;
   bool benign_change = previous_playback_mode_ != PLAYBACK_MODE_SPECTRAL
       && playback_mode_ != PLAYBACK_MODE_SPECTRAL
@@ -307,8 +787,11 @@ void GranularProcessor::Prepare() {
     previous_playback_mode_ = playback_mode_;
   }
   
+  // The parameters belong to the audio thread, which may be queuing
+  // changes into them right now: it releases the freeze when it takes the
+  // engines back.
   if ((playback_mode_changed && !benign_change) || reset_buffers_) {
-    parameters_.freeze = false;
+    release_freeze_ = true;
   }
   
   if (reset_buffers_ || (playback_mode_changed && !benign_change)) {
@@ -317,7 +800,7 @@ void GranularProcessor::Prepare() {
     void* workspace;
     size_t workspace_size;
     if (num_channels_ == 1) {
-      // Large buffer: 120k of sample memory.
+      // Large buffer: sample memory (120k on the module).
       // small buffer: fully allocated to FX workspace.
       buffer[0] = buffer_[0];
       buffer_size[0] = buffer_size_[0];
@@ -326,8 +809,8 @@ void GranularProcessor::Prepare() {
       workspace = buffer_[1];
       workspace_size = buffer_size_[1];
     } else {
-      // Large buffer: 64k of sample memory + FX workspace.
-      // small buffer: 64k of sample memory.
+      // Large buffer: sample memory + FX workspace.
+      // small buffer: sample memory, same size (64k on the module).
       buffer_size[0] = buffer_size[1] = buffer_size_[1];
       buffer[0] = buffer_[0];
       buffer[1] = buffer_[1];
@@ -337,13 +820,63 @@ void GranularProcessor::Prepare() {
     }
     float sr = sample_rate();
 
+    // Wait for ProcessSpectralFrames() to leave, and keep it out.
+    phase_vocoder_.Lock();
+    SeedRandomStreams();
+    
     BufferAllocator allocator(workspace, workspace_size);
-    oliverb_.Init(allocator.Allocate<uint16_t>(16384));
+    diffuser_.Init(allocator.Allocate<float>(2048));
+    oliverb_.Init(
+        reverb_buffer_,
+        reverb_format_,
+        sample_rate_,
+        &random_[RANDOM_STREAM_REVERB]);
     
+    // The pitch shifter (looping delay mode) and the correlator (stretch
+    // mode) are never used together and share their memory.
+    size_t correlator_block_size = (kMaxWSOLASize / 32) + 2;
+    uint32_t* correlator_data = allocator.Allocate<uint32_t>(
+        max<size_t>(correlator_block_size * 3, 2048));
+    correlator_.Init(
+        &correlator_data[0],
+        &correlator_data[correlator_block_size]);
+    pitch_shifter_.Init((uint16_t*)correlator_data);
+    
+    if (playback_mode_ == PLAYBACK_MODE_SPECTRAL) {
+      phase_vocoder_.Init(
+          buffer, buffer_size,
+          lut_sine_window_4096, 4096,
+          num_channels_, resolution(), sr, &random_[RANDOM_STREAM_SPECTRAL]);
+    } else {
+      phase_vocoder_.Release();
+      for (int32_t i = 0; i < num_channels_; ++i) {
+        if (resolution() == 8) {
+          buffer_8_[i].Init(
+              buffer[i],
+              (buffer_size[i]),
+              tail_buffer_[i]);
+        } else {
+          buffer_16_[i].Init(
+              buffer[i],
+              ((buffer_size[i]) >> 1),
+              tail_buffer_[i]);
+        }
+      }
+      player_.Init(
+          num_channels_,
+          num_grains(),
+          &random_[RANDOM_STREAM_GRAIN_SCHEDULER],
+          &random_[RANDOM_STREAM_GRAIN_PAN]);
+      ws_player_.Init(&correlator_, num_channels_);
+      looper_.Init(num_channels_);
+    }
+    phase_vocoder_.Unlock();
+    low_fidelity_phase_ = LOW_FIDELITY_ALIGNED;
     reset_buffers_ = false;
     previous_playback_mode_ = playback_mode_;
   }
-  
+
+  prepare_state_.store(PREPARE_STATE_READY, memory_order_release);
 }
 
 }  // namespace clouds
@@ -29,6 +29,8 @@
 #ifndef CLOUDS_DSP_GRANULAR_PROCESSOR_H_
 #define CLOUDS_DSP_GRANULAR_PROCESSOR_H_
 
+#include <atomic>
+
 #include "stmlib/stmlib.h"
 #include "stmlib/dsp/filter.h"
 
@@ -40,6 +42,7 @@
 #include "clouds/dsp/granular_processor.h"
 #include "clouds/dsp/granular_sample_player.h"
 #include "clouds/dsp/looping_sample_player.h"
+#include "clouds/dsp/parameter_queue.h"
 #include "clouds/dsp/pvoc/phase_vocoder.h"
 #include "clouds/dsp/sample_rate_converter.h"
 #include "clouds/dsp/wsola_sample_player.h"
@@ -48,14 +51,47 @@ namespace clouds {
 
 const int32_t kDownsamplingFactor = 2;
 
+// Memory used by the diffuser, the correlator and the pitch shifter. It is
+// carved out of the large buffer in stereo, and out of the small buffer in
+// mono; the rest of the buffers hold the recordings. On the module, the
+// large buffer is 118784 bytes and the small one 65408 bytes, but any sizes
+// with large >= small + kFxWorkspaceSize work.
+const size_t kFxWorkspaceSize = 16384;
+
 enum PlaybackMode {
   PLAYBACK_MODE_GRANULAR,
   PLAYBACK_MODE_STRETCH,
   PLAYBACK_MODE_LOOPING_DELAY,
   PLAYBACK_MODE_SPECTRAL,
+  PLAYBACK_MODE_OLIVERB,
   PLAYBACK_MODE_LAST
 };
 
+// The processor draws random numbers for independent purposes from
+// independent streams, so that, for example, changing the reverb does not
+// change which grains are played.
+enum RandomStream {
+  RANDOM_STREAM_GRAIN_SCHEDULER,
+  RANDOM_STREAM_GRAIN_PAN,
+  RANDOM_STREAM_SPECTRAL,
+  RANDOM_STREAM_REVERB,
+  RANDOM_STREAM_LAST
+};
+
+// Ownership of the engines and buffers. While PENDING, the audio thread
+// outputs silence and Prepare() is free to reinitialize everything; once
+// Prepare() publishes READY, the audio thread resumes at the next block.
+enum PrepareState {
+  PREPARE_STATE_PENDING,
+  PREPARE_STATE_READY
+};
+
+enum LowFidelityPhase {
+  LOW_FIDELITY_ALIGNED,
+  LOW_FIDELITY_CARRY_INPUT,
+  LOW_FIDELITY_CARRY_OUTPUT
+};
+
 // State of the recording buffer as saved in one of the 4 sample memories.
 struct PersistentState {
   int32_t write_head[2];
@@ -75,14 +111,40 @@ class GranularProcessor {
   GranularProcessor() { }
   ~GranularProcessor() { }
   
+  // The reverb memory is allocated by the host, and must hold
+  // Oliverb::memory_size(reverb_format) bytes. Both sample buffers must be
+  // 4-byte aligned, and small_buffer_size a multiple of 4.
   void Init(
       void* large_buffer,
       size_t large_buffer_size,
       void* small_buffer,
-      size_t small_buffer_size);
+      size_t small_buffer_size,
+      void* reverb_buffer,
+      Format reverb_format);
 
   void Process(FloatFrame* input, FloatFrame* output, size_t size);
+  // Planar I/O, without interleaving. The outputs can alias the inputs.
+  void Process(
+      const float* input_l,
+      const float* input_r,
+      float* output_l,
+      float* output_r,
+      size_t size);
+  void Process(
+      const double* input_l,
+      const double* input_r,
+      double* output_l,
+      double* output_r,
+      size_t size);
+  // Reallocates buffers and switches modes. Can be called from a low
+  // priority thread, concurrently with Process(); it only does work after
+  // Process() has released the engines (see prepare_pending()).
   void Prepare();
+
+  inline bool prepare_pending() const {
+    return prepare_state_.load(std::memory_order_acquire) == \
+        PREPARE_STATE_PENDING;
+  }
   
   inline Parameters* mutable_parameters() {
     return &parameters_;
@@ -92,6 +154,19 @@ class GranularProcessor {
     return parameters_;
   }
   
+  // Sends a parameter change to the audio thread, where it is applied 'time'
+  // samples into the next call to Process(), rounded down to an even sample.
+  // Unlike writes to mutable_parameters(), this can be called from another
+  // thread while Process() runs, as long as it is always the same thread.
+  // Returns false when too many changes are already waiting.
+  inline bool QueueParameter(ParameterId id, float value, uint32_t time = 0) {
+    ParameterEvent event;
+    event.time = time;
+    event.id = id;
+    event.value = value;
+    return parameter_queue_.Push(event);
+  }
+  
   inline void ToggleFreeze() {
     parameters_.freeze = !parameters_.freeze;
   }
@@ -119,11 +194,17 @@ class GranularProcessor {
     return bypass_;
   }
   
+  // Mode, quality and sample rate can be set from any thread. They are only
+  // requests: the audio thread picks them up at the start of the next host
+  // vector and hands the engines over to Prepare() if they changed, so that
+  // a vector never runs with a configuration Prepare() has not set up.
   inline void set_playback_mode(PlaybackMode playback_mode) {
-    playback_mode_ = playback_mode;
+    requested_playback_mode_.store(playback_mode, std::memory_order_relaxed);
   }
   
-  inline PlaybackMode playback_mode() const { return playback_mode_; }
+  inline PlaybackMode playback_mode() const {
+    return requested_playback_mode_.load(std::memory_order_relaxed);
+  }
   
   inline void set_quality(int32_t quality) {
     set_num_channels(quality & 1 ? 1 : 2);
@@ -131,29 +212,103 @@ class GranularProcessor {
   }
   
   inline void set_num_channels(int32_t num_channels) {
-    reset_buffers_ = reset_buffers_ || num_channels_ != num_channels;
-    num_channels_ = num_channels;
+    requested_num_channels_.store(num_channels, std::memory_order_relaxed);
   }
   
   inline void set_low_fidelity(bool low_fidelity) {
-    reset_buffers_ = reset_buffers_ || low_fidelity != low_fidelity_;
-    low_fidelity_ = low_fidelity;
+    requested_low_fidelity_.store(low_fidelity, std::memory_order_relaxed);
   }
   
   inline int32_t quality() const {
     int32_t quality = 0;
-    if (num_channels_ == 1) quality |= 1;
-    if (low_fidelity_) quality |= 2;
+    if (requested_num_channels_.load(std::memory_order_relaxed) == 1) {
+      quality |= 1;
+    }
+    if (requested_low_fidelity_.load(std::memory_order_relaxed)) {
+      quality |= 2;
+    }
     return quality;
   }
 
   inline void sample_rate(float sr) {
-    reset_buffers_ = sample_rate_ != sr;
-    sample_rate_ = sr;
+    requested_sample_rate_.store(sr, std::memory_order_relaxed);
   }
 
   inline void reset_buffers() {
-    reset_buffers_ = true;
+    reset_requested_.store(true, std::memory_order_relaxed);
+  }
+
+  // Points the processor to new sample memory. Only valid while the engines
+  // are released: before the first Process(), or while prepare_pending().
+  // The old buffers can be freed once this returns.
+  inline void set_buffers(
+      void* large_buffer,
+      size_t large_buffer_size,
+      void* small_buffer,
+      size_t small_buffer_size) {
+    buffer_[0] = large_buffer;
+    buffer_[1] = small_buffer;
+    buffer_size_[0] = large_buffer_size;
+    buffer_size_[1] = small_buffer_size;
+    reset_buffers();
+  }
+
+  // The processor and its engines draw from their own generators, so that
+  // instances running on different threads never share state. Instances
+  // that must not sound alike are given different seeds. The streams restart
+  // from a new seed at the next block, and from the current one whenever
+  // Prepare() reinitializes the engines: with the same seed, input and
+  // parameter changes, a render is reproducible.
+  inline void set_random_seed(uint32_t seed) {
+    requested_seed_.store(seed, std::memory_order_relaxed);
+  }
+  
+  inline uint32_t random_seed() const {
+    return requested_seed_.load(std::memory_order_relaxed);
+  }
+  
+  // Number of grains in granular mode, between kMinNumGrains and
+  // kMaxNumGrains. 0 restores the module's count, which depends on the
+  // quality setting. Takes effect at the next block.
+  inline void set_max_num_grains(int32_t max_num_grains) {
+    if (max_num_grains) {
+      CONSTRAIN(max_num_grains, kMinNumGrains, kMaxNumGrains);
+    }
+    requested_max_num_grains_.store(
+        max_num_grains, std::memory_order_relaxed);
+  }
+  
+  // Graceful degradation: the host times its whole audio callback, which
+  // may run several processors, and reports after each host vector of 'size'
+  // samples how long it took, as a fraction of the time it can afford. Above
+  // 0.9, the quality of the grains is lowered until it fits again. Only call
+  // between calls to Process().
+  void ReportLoad(float load, size_t size);
+  
+  // How much the quality of the grains is currently lowered, from 0 to 1.
+  inline float degradation() const {
+    return degradation_;
+  }
+
+  // In spectral mode, the FFTs of each hop run after the block that
+  // completes it, in bursts on the audio thread. When deferred, they are
+  // left to ProcessSpectralFrames(), on another thread, which has until the
+  // end of the next hop to run them. This adds no latency. When it runs
+  // late, Process() runs them itself or, when it is still at it, plays on
+  // without the frame it is transforming.
+  inline void set_defer_spectral_frames(bool defer) {
+    defer_spectral_frames_ = defer;
+  }
+
+  // Audio thread: true when ProcessSpectralFrames() has work to do.
+  inline bool spectral_frames_pending() const {
+    return !prepare_pending() && phase_vocoder_.pending();
+  }
+
+  // Can be called from any thread, concurrently with Process() and
+  // Prepare().
+  inline void ProcessSpectralFrames() {
+    phase_vocoder_.Buffer();
   }
 
   
@@ -170,9 +325,40 @@ class GranularProcessor {
     return sample_rate_ / \
         (low_fidelity_ ? kDownsamplingFactor : 1);
   }
+  
+  inline int32_t num_grains() const {
+    return max_num_grains_ ? max_num_grains_ : \
+        (num_channels_ == 1 ? 40 : 32) * (low_fidelity_ ? 23 : 16) >> 4;
+  }
      
   void ResetFilters();
+  uint32_t stream_seed(int32_t stream) const;
+  void SeedRandomStreams();
+  void ApplyRequestedSettings();
+  bool EnginesReady();
+  void ApplyParameterEvents(size_t time);
+  size_t NextBlockSize(size_t time, size_t size);
+  void ProcessChain(size_t size);
+  void ProcessBackgroundTasks();
+  void ProcessBlock(FloatFrame* input, FloatFrame* output, size_t size);
+  void ProcessBlock(
+      const float* input_l,
+      const float* input_r,
+      float* output_l,
+      float* output_r,
+      size_t size);
+  void ConfigureReverb();
+  template<int stride, int wet_stride>
+  void Mix(
+      const float* dry_l,
+      const float* dry_r,
+      const float* wet_l,
+      const float* wet_r,
+      float* output_l,
+      float* output_r,
+      size_t size);
   void ProcessGranular(FloatFrame* input, FloatFrame* output, size_t size);
+  void ProcessLowFidelity(size_t size);
 
   PlaybackMode playback_mode_;
   PlaybackMode previous_playback_mode_;
@@ -182,10 +368,32 @@ class GranularProcessor {
   bool silence_;
   bool bypass_;
   bool reset_buffers_;
+  // Set by Prepare(), applied to parameters_ by the audio thread.
+  bool release_freeze_;
+  std::atomic<PrepareState> prepare_state_;
+  // Settings waiting to be copied into the fields above, by the thread that
+  // owns the engines: the audio thread, or Prepare() while they are pending.
+  std::atomic<PlaybackMode> requested_playback_mode_;
+  std::atomic<int32_t> requested_num_channels_;
+  std::atomic<bool> requested_low_fidelity_;
+  std::atomic<float> requested_sample_rate_;
+  std::atomic<bool> reset_requested_;
+  std::atomic<uint32_t> requested_seed_;
+  std::atomic<int32_t> requested_max_num_grains_;
   float freeze_lp_;
   float dry_wet_;
   float sample_rate_;
   
+  // Low fidelity mode works on pairs of samples. After an odd slice, the
+  // last input sample waits for the next slice (LOW_FIDELITY_CARRY_INPUT),
+  // or the last output sample does (LOW_FIDELITY_CARRY_OUTPUT).
+  LowFidelityPhase low_fidelity_phase_;
+  FloatFrame low_fidelity_carry_;
+
+  int32_t max_num_grains_;
+  float degradation_;
+  bool defer_spectral_frames_;
+  
   void* buffer_[2];
   size_t buffer_size_[2];
   
@@ -206,15 +414,28 @@ class GranularProcessor {
   AudioBuffer<RESOLUTION_8_BIT_MU_LAW> buffer_8_[2];
   AudioBuffer<RESOLUTION_16_BIT> buffer_16_[2];
   
-  FloatFrame in_[kMaxBlockSize];
+  // One more frame than a slice, for the sample carried over in low fidelity
+  // mode.
+  FloatFrame in_[kMaxBlockSize + 1];
   FloatFrame in_downsampled_[kMaxBlockSize / kDownsamplingFactor];
   FloatFrame out_downsampled_[kMaxBlockSize / kDownsamplingFactor];
-  FloatFrame out_[kMaxBlockSize];
+  FloatFrame out_[kMaxBlockSize + 1];
   FloatFrame fb_[kMaxBlockSize];
+  float planar_in_[2][kMaxBlockSize];
+  float planar_wet_[2][kMaxBlockSize];
   
   int16_t tail_buffer_[2][256];
+
+  // The reverb network is sized for 96kHz, which does not fit in the FX
+  // workspace carved out of the large buffer: its memory comes from the host.
+  void* reverb_buffer_;
+  Format reverb_format_;
   
   Parameters parameters_;
+  ParameterQueue parameter_queue_;
+  size_t num_pending_events_;
+  uint32_t random_seed_;
+  stmlib::RandomGenerator random_[RANDOM_STREAM_LAST];
   
   SampleRateConverter<-kDownsamplingFactor, 45, src_filter_1x_2_45> src_down_;
   SampleRateConverter<+kDownsamplingFactor, 45, src_filter_1x_2_45> src_up_;
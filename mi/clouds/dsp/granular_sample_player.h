@@ -46,7 +46,10 @@
 
 namespace clouds {
 
-const int32_t kMaxNumGrains = 64;
+const int32_t kMinNumGrains = 16;
+const int32_t kMaxNumGrains = 1024;
+const int32_t kGrainMaskSize = kMaxNumGrains / 32;
+const int32_t kNumSharedEnvelopes = 4;
 
 using namespace stmlib;
 
@@ -55,18 +58,57 @@ class GranularSamplePlayer {
   GranularSamplePlayer() { }
   ~GranularSamplePlayer() { }
   
-  void Init(int32_t num_channels, int32_t max_num_grains) {
-    max_num_grains_ = max_num_grains;
-    num_midfi_grains_ = 3 * max_num_grains / 4;
+  void Init(
+      int32_t num_channels,
+      int32_t max_num_grains,
+      RandomGenerator* scheduler_random,
+      RandomGenerator* pan_random) {
+    scheduler_random_ = scheduler_random;
+    pan_random_ = pan_random;
+    set_max_num_grains(max_num_grains);
+    set_degradation(0.0f);
     gain_normalization_ = 1.0f;
     for (int32_t i = 0; i < kMaxNumGrains; ++i) {
       grains_[i].Init();
     }
+    std::fill(&active_grains_[0], &active_grains_[kGrainMaskSize], 0);
+    num_active_grains_ = 0;
+    for (int32_t i = 0; i < kNumSharedEnvelopes; ++i) {
+      envelopes_[i].Init();
+    }
+    num_envelope_requests_ = 0;
+    last_envelope_shape_.width = -1;
     num_grains_ = 0.0f;
     num_channels_ = num_channels;
     grain_size_hint_ = 1024.0f;
   }
   
+  // Can be changed while grains are playing. Grains in slots above the new
+  // count play until the end of their envelope.
+  inline void set_max_num_grains(int32_t max_num_grains) {
+    max_num_grains_ = max_num_grains;
+    num_midfi_grains_ = 3 * max_num_grains / 4;
+  }
+  
+  inline int32_t max_num_grains() const { return max_num_grains_; }
+  
+  // Trades rendering quality for CPU. At 0, the 3/4 of the grains scheduled
+  // last are rendered with linear interpolation, the others with Hermite
+  // interpolation. Towards 0.5, new grains all get linear interpolation; at
+  // 0.5 and above, so do the grains already playing. Towards 1, new grains
+  // get no interpolation and a plain triangular envelope; at 1, so do the
+  // grains already playing.
+  inline void set_degradation(float degradation) {
+    degradation_ = degradation;
+  }
+  
+  // Best quality any grain is rendered with, at the current degradation.
+  inline GrainQuality max_quality() const {
+    return degradation_ >= 1.0f
+        ? GRAIN_QUALITY_LOW
+        : (degradation_ >= 0.5f ? GRAIN_QUALITY_MEDIUM : GRAIN_QUALITY_HIGH);
+  }
+  
   template<Resolution resolution>
   void Play(
       const AudioBuffer<resolution>* buffer,
@@ -83,22 +125,34 @@ class GranularSamplePlayer {
       grain_rate_phasor_ = -1000.0f;
     }
     
-    // Build a list of available grains.
-    int32_t num_available_grains = FillAvailableGrainsList();
+    int32_t num_available_grains = max_num_grains_ - num_active_grains_;
+    if (num_available_grains < 0) {
+      num_available_grains = 0;
+    }
+    
+    // Number of free slots below which new grains get a lower quality.
+    float d = degradation_;
+    int32_t num_midfi_grains = num_midfi_grains_ + static_cast<int32_t>(
+        (max_num_grains_ - num_midfi_grains_) * (d < 0.5f ? 2.0f * d : 1.0f));
+    int32_t num_lofi_grains = static_cast<int32_t>(
+        max_num_grains_ * (d > 0.5f ? 2.0f * d - 1.0f : 0.0f));
+    GrainQuality max_quality = this->max_quality();
     
     // Try to schedule new grains.
     bool seed_trigger = parameters.trigger;
     for (size_t t = 0; t < size; ++t) {
       grain_rate_phasor_ += 1.0f;
-      bool seed_probabilistic = Random::GetFloat() < p
+      bool seed_probabilistic = scheduler_random_->GetFloat() < p
           && target_num_grains > num_grains_;
       bool seed_deterministic = grain_rate_phasor_ >= space_between_grains;
       bool seed = seed_probabilistic || seed_deterministic || seed_trigger;
       if (num_available_grains && seed) {
         --num_available_grains;
-        int32_t index = available_grains_[num_available_grains];
+        int32_t index = AllocateGrain();
         GrainQuality quality;
-        if (num_available_grains < num_midfi_grains_) {
+        if (num_available_grains < num_lofi_grains) {
+          quality = GRAIN_QUALITY_LOW;
+        } else if (num_available_grains < num_midfi_grains) {
           quality = GRAIN_QUALITY_MEDIUM;
         } else {
           quality = GRAIN_QUALITY_HIGH;
@@ -117,34 +171,58 @@ class GranularSamplePlayer {
       }
     }
     
-    // Overlap grains.
+    int32_t active_grains = num_active_grains_;
+    
+    // Overlap grains, visiting only the live ones, in slot order.
     std::fill(&out[0], &out[size * 2], 0.0f);
     float* e = envelope_buffer_;
-    for (int32_t i = 0; i < max_num_grains_; ++i) {
-      Grain* g = &grains_[i];
-      if (g->recommended_quality() == GRAIN_QUALITY_HIGH) {
-        if (num_channels_ == 1) {
-          g->OverlapAdd<1, GRAIN_QUALITY_HIGH>(buffer, out, e, size);
-        } else {
-          g->OverlapAdd<2, GRAIN_QUALITY_HIGH>(buffer, out, e, size);
+    for (int32_t word = 0; word < kGrainMaskSize; ++word) {
+      uint32_t mask = active_grains_[word];
+      while (mask) {
+        int32_t i = word * 32 + LowestSetBit(mask);
+        mask &= mask - 1;
+        Grain* g = &grains_[i];
+        GrainQuality quality = g->recommended_quality();
+        if (quality > max_quality) {
+          quality = max_quality;
         }
-      } else if (g->recommended_quality() == GRAIN_QUALITY_MEDIUM) {
-        if (num_channels_ == 1) {
-          g->OverlapAdd<1, GRAIN_QUALITY_MEDIUM>(buffer, out, e, size);
-        } else {
-          g->OverlapAdd<2, GRAIN_QUALITY_MEDIUM>(buffer, out, e, size);
+        GrainEnvelope* envelope = g->shared_envelope();
+        if (envelope && envelope->shape().quality > quality) {
+          // The cap came down since the grain started.
+          envelope->Release();
+          g->DetachSharedEnvelope();
         }
-      } else {
-        if (num_channels_ == 1) {
-          g->OverlapAdd<1, GRAIN_QUALITY_LOW>(buffer, out, e, size);
+        if (quality == GRAIN_QUALITY_HIGH) {
+          if (num_channels_ == 1) {
+            g->OverlapAdd<1, GRAIN_QUALITY_HIGH>(buffer, out, e, size);
+          } else {
+            g->OverlapAdd<2, GRAIN_QUALITY_HIGH>(buffer, out, e, size);
+          }
+        } else if (quality == GRAIN_QUALITY_MEDIUM) {
+          if (num_channels_ == 1) {
+            g->OverlapAdd<1, GRAIN_QUALITY_MEDIUM>(buffer, out, e, size);
+          } else {
+            g->OverlapAdd<2, GRAIN_QUALITY_MEDIUM>(buffer, out, e, size);
+          }
         } else {
-          g->OverlapAdd<2, GRAIN_QUALITY_LOW>(buffer, out, e, size);
+          if (num_channels_ == 1) {
+            g->OverlapAdd<1, GRAIN_QUALITY_LOW>(buffer, out, e, size);
+          } else {
+            g->OverlapAdd<2, GRAIN_QUALITY_LOW>(buffer, out, e, size);
+          }
+        }
+        if (!g->active()) {
+          active_grains_[word] &= ~(1u << (i & 31));
+          --num_active_grains_;
+          if (g->shared_envelope()) {
+            g->shared_envelope()->Release();
+            g->set_shared_envelope(NULL);
+          }
         }
       }
     }
     
     // Compute normalization factor.
-    int32_t active_grains = max_num_grains_ - num_available_grains;
     SLOPE(num_grains_, static_cast<float>(active_grains), 0.9f, 0.2f);
 
     float gain_normalization = num_grains_ > 2.0f
@@ -164,15 +242,86 @@ class GranularSamplePlayer {
   }
   
  private:
-  int32_t FillAvailableGrainsList() {
-    int32_t num_available_grains = 0;
-    for (int32_t i = 0; i < max_num_grains_; ++i) {
-      if (!grains_[i].active()) {
-        available_grains_[num_available_grains] = i;
-        ++num_available_grains;
+  static inline int32_t LowestSetBit(uint32_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctz(x);
+#else
+    int32_t bit = 0;
+    while (!(x & 1)) {
+      x >>= 1;
+      ++bit;
+    }
+    return bit;
+#endif  // __GNUC__
+  }
+  
+  static inline int32_t HighestSetBit(uint32_t x) {
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(x);
+#else
+    int32_t bit = 31;
+    while (!(x & 0x80000000)) {
+      x <<= 1;
+      --bit;
+    }
+    return bit;
+#endif  // __GNUC__
+  }
+  
+  // Grains with the same shape share their envelope, rendered with the
+  // quality the grains get at the time: their recommended one, capped by the
+  // degradation. Grains whose cap comes down later go back to rendering
+  // their own envelope; a cap going up leaves them with the shared one.
+  // A shared envelope is only set up for a shape requested twice in a row:
+  // when the size or shape are modulated, no two grains are alike, and
+  // grains are better off rendering their own envelope in the scratch
+  // buffer. So are they when all the shared envelopes are in use with other
+  // shapes.
+  GrainEnvelope* AcquireEnvelope(const GrainEnvelopeShape& shape) {
+    if (shape.width > kMaxSharedEnvelopeWidth) {
+      return NULL;
+    }
+    bool repeated = shape == last_envelope_shape_;
+    last_envelope_shape_ = shape;
+    ++num_envelope_requests_;
+    GrainEnvelope* least_recently_used = NULL;
+    for (int32_t i = 0; i < kNumSharedEnvelopes; ++i) {
+      GrainEnvelope* e = &envelopes_[i];
+      if (e->shape() == shape) {
+        e->Acquire(num_envelope_requests_);
+        return e;
+      }
+      if (!e->in_use() && (!least_recently_used ||
+          e->last_used() < least_recently_used->last_used())) {
+        least_recently_used = e;
       }
     }
-    return num_available_grains;
+    if (!repeated) {
+      return NULL;
+    }
+    if (least_recently_used) {
+      least_recently_used->Start(shape);
+      least_recently_used->Acquire(num_envelope_requests_);
+    }
+    return least_recently_used;
+  }
+  
+  // Picks the free slot with the highest index, and marks it as live.
+  int32_t AllocateGrain() {
+    for (int32_t word = (max_num_grains_ - 1) >> 5; word >= 0; --word) {
+      uint32_t free = ~active_grains_[word];
+      int32_t num_slots = max_num_grains_ - (word << 5);
+      if (num_slots < 32) {
+        free &= (1u << num_slots) - 1;
+      }
+      if (free) {
+        int32_t bit = HighestSetBit(free);
+        active_grains_[word] |= 1u << bit;
+        ++num_active_grains_;
+        return (word << 5) + bit;
+      }
+    }
+    return -1;
   }
   
   void ScheduleGrain(
@@ -188,7 +337,8 @@ class GranularSamplePlayer {
     float grain_size = Interpolate(lut_grain_size, parameters.size, 256.0f);
     float pitch_ratio = SemitonesToRatio(pitch);
     float inv_pitch_ratio = SemitonesToRatio(-pitch);
-    float pan = 0.5f + parameters.stereo_spread * (Random::GetFloat() - 0.5f);
+    float pan = 0.5f + parameters.stereo_spread * (
+        pan_random_->GetFloat() - 0.5f);
     float gain_l, gain_r;
     if (num_channels_ == 1) {
       gain_l = Interpolate(lut_sin, pan, 256.0f);
@@ -232,9 +382,16 @@ class GranularSamplePlayer {
         gain_l,
         gain_r,
         quality);
+    GrainEnvelopeShape shape = grain->envelope_shape();
+    if (shape.quality > max_quality()) {
+      shape.quality = max_quality();
+    }
+    grain->set_shared_envelope(AcquireEnvelope(shape));
     ONE_POLE(grain_size_hint_, grain_size, 0.1f);
   }
   
+  RandomGenerator* scheduler_random_;
+  RandomGenerator* pan_random_;
   int32_t max_num_grains_;
   int32_t num_midfi_grains_;
   int32_t num_channels_;
@@ -243,11 +400,19 @@ class GranularSamplePlayer {
   float gain_normalization_;
   float grain_size_hint_;
   float grain_rate_phasor_;
+  float degradation_;
   
+  // Slots [0, max_num_grains_) of grains_ are in use. The live ones are
+  // flagged in active_grains_, one bit per slot.
   Grain grains_[kMaxNumGrains];
-  int32_t available_grains_[kMaxNumGrains];
+  uint32_t active_grains_[kGrainMaskSize];
+  int32_t num_active_grains_;
   float envelope_buffer_[kMaxBlockSize];
   
+  GrainEnvelope envelopes_[kNumSharedEnvelopes];
+  uint32_t num_envelope_requests_;
+  GrainEnvelopeShape last_envelope_shape_;
+  
   DISALLOW_COPY_AND_ASSIGN(GranularSamplePlayer);
 };
 
@@ -116,15 +116,20 @@ class LoopingSamplePlayer {
         float error = (target_delay - current_delay_);
         float delay = current_delay_ + 0.0005f * error;
         current_delay_ = delay;
-        int32_t delay_int = (buffer->head() - 4 - size + buffer->size()) << 12;
-        delay_int -= static_cast<int32_t>(delay * 4096.0f);
+        // 20.12 fixed point no longer fits in 32 bits for buffers longer
+        // than 2^19 samples.
+        int64_t delay_int = static_cast<int64_t>(
+            buffer->head() - 4 - size + buffer->size()) << 12;
+        delay_int -= static_cast<int64_t>(delay * 4096.0f);
         
-        float l = buffer[0].ReadHermite((delay_int >> 12), delay_int << 4);
+        float l = buffer[0].ReadHermite(
+            static_cast<int32_t>(delay_int >> 12), delay_int << 4);
         if (num_channels_ == 1) {
           *out++ = l;
           *out++ = l;
         } else if (num_channels_ == 2) {
-          float r = buffer[1].ReadHermite((delay_int >> 12), delay_int << 4);
+          float r = buffer[1].ReadHermite(
+              static_cast<int32_t>(delay_int >> 12), delay_int << 4);
           *out++ = l + (r - l) * swap_channels;
           *out++ = r + (l - r) * swap_channels;
         }
@@ -173,35 +178,40 @@ class LoopingSamplePlayer {
           gain = phase_ / tail_duration_;
           CONSTRAIN(gain, 0.0f, 1.0f);
         }
-        int32_t delay_int = (buffer->head() - 4 + buffer->size()) << 12;
+        int64_t delay_int = static_cast<int64_t>(
+            buffer->head() - 4 + buffer->size()) << 12;
 
         float ph = parameters.granular.reverse ?
           loop_duration_ - phase_ :
           phase_;
 
-        int32_t position = delay_int - static_cast<int32_t>(
+        int64_t position = delay_int - static_cast<int64_t>(
           (loop_duration_ - ph + loop_point_) * 4096.0f);
-        float l = buffer[0].ReadHermite((position >> 12), position << 4);
+        float l = buffer[0].ReadHermite(
+            static_cast<int32_t>(position >> 12), position << 4);
         if (num_channels_ == 1) {
           out[0] = l * gain;
           out[1] = l * gain;
         } else if (num_channels_ == 2) {
-          float r = buffer[1].ReadHermite((position >> 12), position << 4);
+          float r = buffer[1].ReadHermite(
+              static_cast<int32_t>(position >> 12), position << 4);
           out[0] = (l + (r - l) * swap_channels) * gain;
           out[1] = (r + (l - r) * swap_channels) * gain;
         }
         
         if (gain != 1.0f) {
           gain = 1.0f - gain;
-          int32_t position = delay_int - static_cast<int32_t>(
+          int64_t position = delay_int - static_cast<int64_t>(
                 (-phase_ + tail_start_) * 4096.0f);
         
-          float l = buffer[0].ReadHermite((position >> 12), position << 4);
+          float l = buffer[0].ReadHermite(
+              static_cast<int32_t>(position >> 12), position << 4);
           if (num_channels_ == 1) {
             out[0] += l * gain;
             out[1] += l * gain;
           } else if (num_channels_ == 2) {
-            float r = buffer[1].ReadHermite((position >> 12), position << 4);
+            float r = buffer[1].ReadHermite(
+                static_cast<int32_t>(position >> 12), position << 4);
             out[0] += (l + (r - l) * swap_channels) * gain;
             out[1] += (r + (l - r) * swap_channels) * gain;
           }
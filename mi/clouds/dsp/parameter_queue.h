@@ -0,0 +1,165 @@
+// Copyright 2026 agent.
+//
+// Author: agent (agent@local)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Parameter changes sent to the audio thread.
+
+#ifndef CLOUDS_DSP_PARAMETER_QUEUE_H_
+#define CLOUDS_DSP_PARAMETER_QUEUE_H_
+
+#include <atomic>
+
+#include "stmlib/stmlib.h"
+
+#include "clouds/dsp/parameters.h"
+
+namespace clouds {
+
+const size_t kParameterQueueSize = 512;
+
+enum ParameterId {
+  PARAMETER_POSITION,
+  PARAMETER_SIZE,
+  PARAMETER_PITCH,
+  PARAMETER_DENSITY,
+  PARAMETER_TEXTURE,
+  PARAMETER_DRY_WET,
+  PARAMETER_STEREO_SPREAD,
+  PARAMETER_FEEDBACK,
+  PARAMETER_REVERB,
+  PARAMETER_FREEZE,
+  PARAMETER_TRIGGER,
+  PARAMETER_OLIVERB_DIFFUSION,
+  PARAMETER_OLIVERB_SIZE,
+  PARAMETER_OLIVERB_MOD_RATE,
+  PARAMETER_OLIVERB_MOD_AMOUNT,
+  PARAMETER_OLIVERB_RATIO,
+  PARAMETER_OLIVERB_PITCH,
+  PARAMETER_OLIVERB_DENSITY,
+  PARAMETER_OLIVERB_TEXTURE,
+  PARAMETER_LAST
+};
+
+// A new value for one of the parameters, due 'time' samples after the start
+// of the next host vector. Booleans are true above 0.5.
+struct ParameterEvent {
+  uint32_t time;
+  uint32_t id;
+  float value;
+};
+
+inline void ApplyParameterEvent(
+    const ParameterEvent& event,
+    Parameters* parameters) {
+  float value = event.value;
+  switch (event.id) {
+    case PARAMETER_POSITION: parameters->position = value; break;
+    case PARAMETER_SIZE: parameters->size = value; break;
+    case PARAMETER_PITCH: parameters->pitch = value; break;
+    case PARAMETER_DENSITY: parameters->density = value; break;
+    case PARAMETER_TEXTURE: parameters->texture = value; break;
+    case PARAMETER_DRY_WET: parameters->dry_wet = value; break;
+    case PARAMETER_STEREO_SPREAD: parameters->stereo_spread = value; break;
+    case PARAMETER_FEEDBACK: parameters->feedback = value; break;
+    case PARAMETER_REVERB: parameters->reverb = value; break;
+    case PARAMETER_FREEZE: parameters->freeze = value > 0.5f; break;
+    case PARAMETER_TRIGGER:
+      parameters->trigger = parameters->trigger || value > 0.5f;
+      break;
+    case PARAMETER_OLIVERB_DIFFUSION:
+      parameters->oliverb_diffusion = value;
+      break;
+    case PARAMETER_OLIVERB_SIZE: parameters->oliverb_size = value; break;
+    case PARAMETER_OLIVERB_MOD_RATE:
+      parameters->oliverb_mod_rate = value;
+      break;
+    case PARAMETER_OLIVERB_MOD_AMOUNT:
+      parameters->oliverb_mod_amount = value;
+      break;
+    case PARAMETER_OLIVERB_RATIO: parameters->oliverb_ratio = value; break;
+    case PARAMETER_OLIVERB_PITCH: parameters->oliverb_pitch = value; break;
+    case PARAMETER_OLIVERB_DENSITY: parameters->oliverb_density = value; break;
+    case PARAMETER_OLIVERB_TEXTURE: parameters->oliverb_texture = value; break;
+    default: break;
+  }
+}
+
+// Single producer, single consumer ring of parameter events. Unlike
+// stmlib::RingBuffer, which relies on volatile and a single core, the
+// pointers are published with acquire/release ordering, so that the writer
+// and the reader can run on different cores. Neither side ever blocks.
+class ParameterQueue {
+ public:
+  ParameterQueue() { }
+  ~ParameterQueue() { }
+
+  // Not thread-safe: call before the producer and the consumer start.
+  void Init() {
+    read_ptr_.store(0, std::memory_order_relaxed);
+    write_ptr_.store(0, std::memory_order_relaxed);
+  }
+
+  // Producer side. Returns false, and drops the event, when the queue is
+  // full.
+  inline bool Push(const ParameterEvent& event) {
+    size_t w = write_ptr_.load(std::memory_order_relaxed);
+    size_t r = read_ptr_.load(std::memory_order_acquire);
+    if (w - r >= kParameterQueueSize) {
+      return false;
+    }
+    events_[w & (kParameterQueueSize - 1)] = event;
+    write_ptr_.store(w + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  inline size_t readable() const {
+    return write_ptr_.load(std::memory_order_acquire) - \
+        read_ptr_.load(std::memory_order_relaxed);
+  }
+
+  // Only valid when readable() is non-zero.
+  inline const ParameterEvent& front() const {
+    return events_[read_ptr_.load(std::memory_order_relaxed) & \
+        (kParameterQueueSize - 1)];
+  }
+
+  inline void Pop() {
+    read_ptr_.store(
+        read_ptr_.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+  }
+
+ private:
+  std::atomic<size_t> read_ptr_;
+  std::atomic<size_t> write_ptr_;
+  ParameterEvent events_[kParameterQueueSize];
+
+  DISALLOW_COPY_AND_ASSIGN(ParameterQueue);
+};
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_PARAMETER_QUEUE_H_
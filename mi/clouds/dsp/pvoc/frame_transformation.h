@@ -30,6 +30,7 @@
 #define CLOUDS_DSP_PVOC_FRAME_TRANSFORMATION_H_
 
 #include "stmlib/stmlib.h"
+#include "stmlib/utils/random.h"
 
 #include "clouds/dsp/pvoc/stft.h"
 
@@ -47,7 +48,11 @@ class FrameTransformation {
   FrameTransformation() { }
   ~FrameTransformation() { }
   
-  void Init(float* buffer, int32_t fft_size, int32_t num_textures);
+  void Init(
+      float* buffer,
+      int32_t fft_size,
+      int32_t num_textures,
+      stmlib::RandomGenerator* random);
   void Reset();
   
   void Process(
@@ -79,6 +84,7 @@ class FrameTransformation {
     *im = magnitude * lut_sin[angle];
   }
   
+  stmlib::RandomGenerator* random_;
   int32_t fft_size_;
   int32_t num_textures_;
   int32_t size_;
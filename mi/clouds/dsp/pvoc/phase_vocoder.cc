@@ -44,11 +44,13 @@ void PhaseVocoder::Init(
     size_t largest_fft_size,
     int32_t num_channels,
     int32_t resolution,
-    float sample_rate) {
+    float sample_rate,
+    RandomGenerator* random) {
   num_channels_ = num_channels;
+  random_ = random;
+  reseed_.store(false, memory_order_relaxed);
 
   size_t fft_size = largest_fft_size;
-  size_t hop_ratio = 4;
   
   BufferAllocator allocator_0(buffer[0], buffer_size[0]);
   BufferAllocator allocator_1(buffer[1], buffer_size[1]);
@@ -59,26 +61,26 @@ void PhaseVocoder::Init(
   size_t num_textures = kMaxNumTextures;
   size_t texture_size = (fft_size >> 1) - kHighFrequencyTruncation;
   for (int32_t i = 0; i < num_channels_; ++i) {
-    short* ana_syn_buffer = allocator[i]->Allocate<short>(
-        (fft_size + (fft_size >> 1)) * 2);
-    
     num_textures = min(
         allocator[i]->free() / (sizeof(float) * texture_size),
         num_textures);
     stft_[i].Init(
         &fft_,
         fft_size,
-        fft_size / hop_ratio,
+        fft_size / kHopRatio,
         fft_buffer,
         ifft_buffer,
         large_window_lut,
-        ana_syn_buffer,
+        window_,
+        analysis_synthesis_[i],
+        frames_[i],
         &frame_transformation_[i]);
   }
   for (int32_t i = 0; i < num_channels_; ++i) {
     float* texture_buffer = allocator[i]->Allocate<float>(
         num_textures * texture_size);
-    frame_transformation_[i].Init(texture_buffer, fft_size, num_textures);
+    frame_transformation_[i].Init(
+        texture_buffer, fft_size, num_textures, random);
   }
 }
 
@@ -88,19 +90,54 @@ void PhaseVocoder::Process(
     FloatFrame* output, size_t size) {
   const float* input_samples = &input[0].l;
   float* output_samples = &output[0].l;
-  for (int32_t i = 0; i < num_channels_; ++i) {
-    stft_[i].Process(
-        parameters,
-        input_samples + i,
-        output_samples + i,
-        size,
-        2);
+  while (size) {
+    // The next hop plays the overlap-add of the oldest waiting frame.
+    // Transform it now if no other thread is at it, otherwise play on: the
+    // frames still being transformed are dropped.
+    if (stft_[0].late()) {
+      if (TryLock()) {
+        Transform();
+        Unlock();
+      }
+      for (int32_t i = 0; i < num_channels_; ++i) {
+        stft_[i].Play();
+      }
+    }
+    size_t processed = min(size, stft_[0].hop_remaining());
+    for (int32_t i = 0; i < num_channels_; ++i) {
+      stft_[i].Process(
+          parameters,
+          input_samples + i,
+          output_samples + i,
+          processed,
+          2);
+    }
+    input_samples += 2 * processed;
+    output_samples += 2 * processed;
+    size -= processed;
   }
 }
 
 void PhaseVocoder::Buffer() {
-  for (int32_t i = 0; i < num_channels_; ++i) {
-    stft_[i].Buffer();
+  if (!TryLock()) {
+    return;
+  }
+  Transform();
+  Unlock();
+}
+
+void PhaseVocoder::Transform() {
+  if (reseed_.exchange(false, memory_order_acquire)) {
+    random_->Seed(requested_seed_.load(memory_order_relaxed));
+  }
+  // The channels are transformed in turn, frame after frame, in the order
+  // they draw from the shared random generator.
+  bool transformed = true;
+  while (transformed) {
+    transformed = false;
+    for (int32_t i = 0; i < num_channels_; ++i) {
+      transformed = stft_[i].Buffer() || transformed;
+    }
   }
 }
 
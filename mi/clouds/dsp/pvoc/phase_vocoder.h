@@ -29,6 +29,9 @@
 #ifndef CLOUDS_DSP_PVOC_PHASE_VOCODER_H_
 #define CLOUDS_DSP_PVOC_PHASE_VOCODER_H_
 
+#include <atomic>
+#include <thread>
+
 #include "stmlib/stmlib.h"
 
 #include "stmlib/fft/shy_fft.h"
@@ -41,9 +44,11 @@ namespace clouds {
 
 struct Parameters;
 
+const size_t kHopRatio = 4;
+
 class PhaseVocoder {
  public:
-  PhaseVocoder() { }
+  PhaseVocoder() : num_channels_(0), busy_(false), reseed_(false) { }
   ~PhaseVocoder() { }
   
   void Init(
@@ -51,22 +56,84 @@ class PhaseVocoder {
       const float* large_window_lut, size_t largest_fft_size,
       int32_t num_channels,
       int32_t resolution,
-      float sample_rate);
+      float sample_rate,
+      stmlib::RandomGenerator* random);
 
   void Process(
       const Parameters& parameters,
       const FloatFrame* input,
       FloatFrame* output,
       size_t size);
+
+  // Transforms the frames of the hops completed by Process(). Can be called
+  // from another thread, concurrently with Process(): each frame must be
+  // transformed before the end of the next hop. Otherwise Process() does it
+  // itself or, when another thread is at it, drops the frame rather than
+  // wait. Returns at once when another thread is already at it.
   void Buffer();
+
+  // True when a frame waits for Buffer().
+  inline bool pending() const {
+    for (int32_t i = 0; i < num_channels_; ++i) {
+      if (stft_[i].ready()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Reseeds the random generator of the frame transformations before the
+  // next frame Buffer() transforms. Can be called from any thread.
+  inline void Reseed(uint32_t seed) {
+    requested_seed_.store(seed, std::memory_order_relaxed);
+    reseed_.store(true, std::memory_order_release);
+  }
+
+  // Keeps Buffer() out, for example while the engines are reinitialized.
+  // Waits for it to leave: not for the audio thread.
+  inline void Lock() {
+    while (!TryLock()) {
+      std::this_thread::yield();
+    }
+  }
+
+  inline bool TryLock() {
+    return !busy_.exchange(true, std::memory_order_acquire);
+  }
+
+  inline void Unlock() {
+    busy_.store(false, std::memory_order_release);
+  }
+
+  // Gives the sample memory back to the other modes: Buffer() does nothing
+  // until the next Init(). Call with the lock held.
+  inline void Release() {
+    num_channels_ = 0;
+  }
   
  private:
+  // Call with the lock held.
+  void Transform();
+
   FFT fft_;
   
   STFT stft_[2];
   FrameTransformation frame_transformation_[2];
 
+  // The float rings and windows of the STFTs. The module kept the rings in
+  // 16-bit, in the sample memory; they now leave all of it to the textures.
+  float analysis_synthesis_[2][2 * (kMaxFftSize + kMaxFftSize / kHopRatio)];
+  float window_[2 * kMaxFftSize];
+
+  // The frames waiting for their transform, or for their overlap-add.
+  float frames_[2][kNumFrameSlots * kMaxFftSize];
+
   int32_t num_channels_;
+  std::atomic<bool> busy_;
+
+  stmlib::RandomGenerator* random_;
+  std::atomic<bool> reseed_;
+  std::atomic<uint32_t> requested_seed_;
   
   DISALLOW_COPY_AND_ASSIGN(PhaseVocoder);
 };
@@ -31,6 +31,7 @@
 #include <algorithm>
 
 #include "clouds/dsp/pvoc/frame_transformation.h"
+#include "clouds/dsp/simd.h"
 #include "stmlib/dsp/dsp.h"
 
 namespace clouds {
@@ -45,7 +46,9 @@ void STFT::Init(
     float* fft_buffer,
     float* ifft_buffer,
     const float* window_lut,
-    short* analysis_synthesis_buffer,
+    float* window_buffer,
+    float* analysis_synthesis_buffer,
+    float* frame_buffer,
     Modifier* modifier) {
   fft_size_ = fft_size;
   hop_size_ = hop_size;
@@ -64,16 +67,33 @@ void STFT::Init(
   
   analysis_ = &analysis_synthesis_buffer[0];
   synthesis_ = &analysis_synthesis_buffer[buffer_size_];
+  for (size_t i = 0; i < kNumFrameSlots; ++i) {
+    frame_[i] = &frame_buffer[i * fft_size_];
+  }
 
   ifft_in_ = fft_in_ = fft_buffer;
   ifft_out_ = fft_out_ = ifft_buffer;
   
-  window_ = window_lut;
-  window_stride_ = LUT_SINE_WINDOW_4096_SIZE / fft_size;
+  // The analysis window scales the input to the 16-bit range the module
+  // worked in, so that the frame transformations see the same magnitudes.
+  // The synthesis window undoes it, along with the FFT and overlap gains.
+#ifdef USE_ARM_FFT
+  float inverse_window_size = 1.0f / \
+      float(fft_size_ / hop_size_ >> 1);
+#else
+  float inverse_window_size = 1.0f / \
+      float(fft_size_ * fft_size_ / hop_size_ >> 1);
+#endif  // USE_ARM_FFT
+  size_t window_stride = LUT_SINE_WINDOW_4096_SIZE / fft_size;
+  analysis_window_ = &window_buffer[0];
+  synthesis_window_ = &window_buffer[fft_size_];
+  for (size_t i = 0; i < fft_size_; ++i) {
+    float w = window_lut[i * window_stride];
+    analysis_window_[i] = w * 32768.0f;
+    synthesis_window_[i] = w * inverse_window_size / 16384.0f;
+  }
   modifier_ = modifier;
   
-  parameters_ = NULL;
-  
   Reset();
 }
 
@@ -81,10 +101,14 @@ void STFT::Reset() {
   buffer_ptr_ = 0;
   process_ptr_ = (2 * hop_size_) % buffer_size_;
   block_size_ = 0;
-  fill(&analysis_[0], &analysis_[buffer_size_], 0);
-  fill(&synthesis_[0], &synthesis_[buffer_size_], 0);
-  ready_ = 0;
-  done_ = 0;
+  fill(&analysis_[0], &analysis_[buffer_size_], 0.0f);
+  fill(&synthesis_[0], &synthesis_[buffer_size_], 0.0f);
+  recorded_.store(0, memory_order_relaxed);
+  played_ = 0;
+  for (size_t i = 0; i < kNumFrameSlots; ++i) {
+    frame_state_[i].store(FRAME_FREE, memory_order_relaxed);
+  }
+  next_frame_ = 0;
 }
 
 void STFT::Process(
@@ -93,13 +117,11 @@ void STFT::Process(
     float* output,
     size_t size,
     size_t stride) {
-  parameters_ = &parameters;
   while (size) {
     size_t processed = min(size, hop_size_ - block_size_);
     for (size_t i = 0; i < processed; ++i) {
-      int32_t sample = *input * 32768.0f;
-      analysis_[buffer_ptr_ + i] = Clip16(sample);
-      *output = static_cast<float>(synthesis_[buffer_ptr_ + i]) / 16384.0f;
+      analysis_[buffer_ptr_ + i] = *input;
+      *output = synthesis_[buffer_ptr_ + i];
       input += stride;
       output += stride;
     }
@@ -112,28 +134,88 @@ void STFT::Process(
     }
     if (block_size_ >= hop_size_) {
       block_size_ -= hop_size_;
-      ++ready_;
+      Record(parameters);
     }
   }
 }
 
-void STFT::Buffer() {
-  if (ready_ == done_) {
-    return;
+void STFT::Record(const Parameters& parameters) {
+  size_t frame = recorded_.load(memory_order_relaxed);
+  size_t slot = frame % kNumFrameSlots;
+  // The slot can still be held by Buffer(), for a frame dropped by Play().
+  // This frame is then dropped too.
+  if (stage(frame_state_[slot].load(memory_order_acquire)) == FRAME_FREE) {
+    Analyze(frame_[slot]);
+    parameters_[slot] = parameters;
+    frame_state_[slot].store(
+        frame_state(frame, FRAME_RECORDED),
+        memory_order_release);
   }
-  
-  // Copy block to FFT buffer and apply window.
-  size_t source_ptr = process_ptr_;
-  const float* w = window_;
-  for (size_t i = 0; i < fft_size_; ++i) {
-    fft_in_[i] = w[0] * analysis_[source_ptr];
-    ++source_ptr;
-    if (source_ptr >= buffer_size_) {
-      source_ptr -= buffer_size_;
+  recorded_.store(frame + 1, memory_order_release);
+}
+
+void STFT::Play() {
+  size_t frame = played_++;
+  size_t slot = frame % kNumFrameSlots;
+  size_t state = frame_state_[slot].load(memory_order_acquire);
+  while (true) {
+    if (state == frame_state(frame, FRAME_TRANSFORMED)) {
+      Synthesize(frame_[slot]);
+      frame_state_[slot].store(FRAME_FREE, memory_order_relaxed);
+      break;
+    } else if (state == frame_state(frame, FRAME_RECORDED)) {
+      if (frame_state_[slot].compare_exchange_weak(
+              state, FRAME_FREE, memory_order_acquire)) {
+        break;
+      }
+    } else if (state == frame_state(frame, FRAME_CLAIMED)) {
+      if (frame_state_[slot].compare_exchange_weak(
+              state, frame_state(frame, FRAME_ABANDONED),
+              memory_order_acquire)) {
+        break;
+      }
+    } else {
+      // Dropped by Record().
+      break;
     }
-    w += window_stride_;
   }
-  
+  process_ptr_ += hop_size_;
+  if (process_ptr_ >= buffer_size_) {
+    process_ptr_ -= buffer_size_;
+  }
+}
+
+bool STFT::Buffer() {
+  size_t end = recorded_.load(memory_order_acquire);
+  // The frames before the last two have already been played.
+  size_t frame = max(next_frame_, end < 2 ? 0 : end - 2);
+  for (; frame < end; ++frame) {
+    size_t slot = frame % kNumFrameSlots;
+    size_t state = frame_state(frame, FRAME_RECORDED);
+    if (frame_state_[slot].compare_exchange_strong(
+            state, frame_state(frame, FRAME_CLAIMED),
+            memory_order_acquire)) {
+      next_frame_ = frame + 1;
+      Transform(slot);
+      state = frame_state(frame, FRAME_CLAIMED);
+      if (!frame_state_[slot].compare_exchange_strong(
+              state, frame_state(frame, FRAME_TRANSFORMED),
+              memory_order_release)) {
+        // Played without it in the meantime.
+        frame_state_[slot].store(FRAME_FREE, memory_order_release);
+      }
+      return true;
+    }
+  }
+  next_frame_ = frame;
+  return false;
+}
+
+void STFT::Transform(size_t slot) {
+  // The transforms work in the FFT buffers: the frame transformation leaves
+  // the top bins of ifft_in as the FFT left them.
+  copy(&frame_[slot][0], &frame_[slot][fft_size_], &fft_in_[0]);
+
   // Compute FFT. fft_in is lost.
 #ifdef USE_ARM_FFT
   arm_rfft_fast_f32(fft_, fft_in_, fft_out_, 0);
@@ -150,12 +232,7 @@ void STFT::Buffer() {
     fft_->Direct(fft_in_, fft_out_);
   }
 #endif  // USE_ARM_FFT
-  // Process in the frequency domain.
-  if (modifier_ != NULL && parameters_ != NULL) {
-    modifier_->Process(*parameters_, &fft_out_[0], &ifft_in_[0]);
-  } else {
-    copy(&fft_out_[0], &fft_out_[fft_size_], &ifft_in_[0]);
-  }
+  Modify(parameters_[slot], fft_out_, ifft_in_);
   
   // Compute IFFT. ifft_in is lost.
 #ifdef USE_ARM_FFT
@@ -173,37 +250,59 @@ void STFT::Buffer() {
     fft_->Inverse(ifft_in_, ifft_out_);
   }
 #endif  // USE_ARM_FFT
-  
+
+  copy(&ifft_out_[0], &ifft_out_[fft_size_], &frame_[slot][0]);
+}
+
+void STFT::Analyze(float* destination) {
+  // Copy the hop just completed and the ones before it to the frame and apply
+  // window, in at most two runs around the end of the ring.
+  size_t start = buffer_ptr_ + hop_size_;
+  if (start >= buffer_size_) {
+    start -= buffer_size_;
+  }
+  size_t head = min(fft_size_, buffer_size_ - start);
+  MultiplyBlock(
+      &analysis_[start], &analysis_window_[0], &destination[0], head);
+  MultiplyBlock(
+      &analysis_[0], &analysis_window_[head], &destination[head],
+      fft_size_ - head);
+}
+
+void STFT::Modify(
+    const Parameters& parameters,
+    float* fft_out,
+    float* ifft_in) {
+  // Process in the frequency domain.
+  if (modifier_ != NULL) {
+    modifier_->Process(parameters, &fft_out[0], &ifft_in[0]);
+  } else {
+    copy(&fft_out[0], &fft_out[fft_size_], &ifft_in[0]);
+  }
+}
+
+void STFT::Synthesize(const float* source) {
+  // Apply window and overlap-add, except for the last hop which replaces
+  // samples that have already been played.
+  size_t overlap = fft_size_ - hop_size_;
   size_t destination_ptr = process_ptr_;
-#ifdef USE_ARM_FFT
-  float inverse_window_size = 1.0f / \
-      float(fft_size_ / hop_size_ >> 1);
-#else
-  float inverse_window_size = 1.0f / \
-      float(fft_size_ * fft_size_ / hop_size_ >> 1);
-#endif  // USE_ARM_FFT
-    
-  w = window_;
-  for (size_t i = 0; i < fft_size_; ++i) {
-    float s = ifft_out_[i] * w[0] * inverse_window_size;
-    
-    int32_t x = static_cast<int32_t>(s);
-    if (i < fft_size_ - hop_size_) {
-      // Overlap-add.
-      x += synthesis_[destination_ptr];
+  for (size_t i = 0; i < fft_size_; ) {
+    size_t end = i < overlap ? overlap : fft_size_;
+    size_t n = min(end - i, buffer_size_ - destination_ptr);
+    if (i < overlap) {
+      MultiplyAddBlock(
+          &source[i], &synthesis_window_[i], &synthesis_[destination_ptr],
+          n);
+    } else {
+      MultiplyBlock(
+          &source[i], &synthesis_window_[i], &synthesis_[destination_ptr],
+          n);
     }
-    synthesis_[destination_ptr] = Clip16(x);
-    ++destination_ptr;
+    i += n;
+    destination_ptr += n;
     if (destination_ptr >= buffer_size_) {
       destination_ptr -= buffer_size_;
     }
-    w += window_stride_;
-  }
-
-  ++done_;
-  process_ptr_ += hop_size_;
-  if (process_ptr_ >= buffer_size_) {
-    process_ptr_ -= buffer_size_;
   }
 }
 
@@ -29,23 +29,35 @@
 #ifndef CLOUDS_DSP_PVOC_STFT_H_
 #define CLOUDS_DSP_PVOC_STFT_H_
 
+#include <atomic>
+
 #include "stmlib/stmlib.h"
 
+#include "clouds/dsp/parameters.h"
+
+// FFT backend, picked at build time: the module's ShyFFT (default), CMSIS'
+// (USE_ARM_FFT), or StockhamFFT (USE_STOCKHAM_FFT), the fastest on desktop
+// CPUs. The last two have the same interface and spectrum layout.
+
 // #define USE_ARM_FFT
+// #define USE_STOCKHAM_FFT
 
 #ifdef USE_ARM_FFT
   #include <arm_math.h>
+#elif defined(USE_STOCKHAM_FFT)
+  #include "clouds/dsp/pvoc/stockham_fft.h"
 #else
   #include "stmlib/fft/shy_fft.h"
 #endif  // USE_ARM_FFT
 
 namespace clouds {
 
-struct Parameters;
-
 const size_t kMaxFftSize = 4096;
+const size_t kNumFrameSlots = 3;
 #ifdef USE_ARM_FFT
   typedef arm_rfft_fast_instance_f32 FFT;
+#elif defined(USE_STOCKHAM_FFT)
+  typedef StockhamFFT<kMaxFftSize> FFT;
 #else
   typedef stmlib::ShyFFT<float, kMaxFftSize, stmlib::RotationPhasor> FFT;
 #endif  // USE_ARM_FFT
@@ -57,8 +69,9 @@ class STFT {
   STFT() { }
   ~STFT() { }
   
-  struct Frame { short l; short r; };
-  
+  // analysis_synthesis_buffer holds 2 * (fft_size + hop_size) samples,
+  // window_buffer 2 * fft_size, and can be shared by STFTs of the same size,
+  // frame_buffer kNumFrameSlots * fft_size.
   void Init(
       FFT* fft,
       size_t fft_size,
@@ -66,11 +79,17 @@ class STFT {
       float* fft_buffer,
       float* ifft_buffer,
       const float* window_lut,
-      short* stft_frame_processor_buffer,
+      float* window_buffer,
+      float* analysis_synthesis_buffer,
+      float* frame_buffer,
       Modifier* modifier);
 
   void Reset();
 
+  // Audio side: windows the input in, and the transformed frames out. When a
+  // hop is complete, its frame is windowed into a slot for Buffer() to
+  // transform, and it is overlap-added back when the next hop starts (see
+  // late() and Play()).
   void Process(
       const Parameters& parameters,
       const float* input,
@@ -78,8 +97,42 @@ class STFT {
       size_t size,
       size_t stride);
 
-  void Buffer();
+  // Transforms the oldest frame waiting in its slot, and returns false when
+  // there is none. Buffer() can run on another thread than Process(), but on
+  // one thread at a time.
+  bool Buffer();
+
+  // True when a frame is waiting for Buffer().
+  inline bool ready() const {
+    for (size_t i = 0; i < kNumFrameSlots; ++i) {
+      if (stage(frame_state_[i].load(std::memory_order_relaxed)) == \
+          FRAME_RECORDED) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // True when a hop is about to start whose samples are still waiting for
+  // the overlap-add of an older frame: Play() must run before Process().
+  inline bool late() const {
+    return block_size_ == 0 && \
+        recorded_.load(std::memory_order_relaxed) - played_ >= 2;
+  }
+
+  // Audio side: overlap-adds the oldest frame. When Buffer() has not
+  // transformed it yet, the frame is dropped instead of waited for.
+  void Play();
+
+  // The steps around the FFT and the IFFT: windowing of a frame, processing
+  // of its spectrum, and overlap-add of the transformed frame.
+  void Analyze(float* destination);
+  void Modify(const Parameters& parameters, float* fft_out, float* ifft_in);
+  void Synthesize(const float* source);
   
+  // Samples left before the current hop is complete.
+  inline size_t hop_remaining() const { return hop_size_ - block_size_; }
+
  private:
   FFT* fft_;
   size_t fft_size_;
@@ -91,20 +144,56 @@ class STFT {
   float* ifft_out_;
   float* ifft_in_;
   
-  const float* window_;
-  size_t window_stride_;
+  // The window LUT resampled to fft_size_, with the input and output
+  // scaling folded in.
+  float* analysis_window_;
+  float* synthesis_window_;
 
-  short* analysis_;
-  short* synthesis_;
+  // Float rings: the module used 16-bit to save RAM, at the cost of
+  // quantization noise.
+  float* analysis_;
+  float* synthesis_;
   
+  // The state of a slot is the number of its frame, times 8, plus its stage.
+  // A slot is written by the audio thread while FRAME_FREE or
+  // FRAME_TRANSFORMED, and by Buffer() while FRAME_CLAIMED. A frame dropped
+  // while Buffer() has it is FRAME_ABANDONED, until Buffer() frees the slot.
+  enum FrameStage {
+    FRAME_FREE,
+    FRAME_RECORDED,
+    FRAME_CLAIMED,
+    FRAME_TRANSFORMED,
+    FRAME_ABANDONED
+  };
+
+  static inline size_t frame_state(size_t frame, FrameStage stage) {
+    return frame * 8 + stage;
+  }
+
+  static inline FrameStage stage(size_t state) {
+    return static_cast<FrameStage>(state & 7);
+  }
+
+  void Record(const Parameters& parameters);
+  void Transform(size_t slot);
+
   size_t buffer_ptr_;
   size_t process_ptr_;
   size_t block_size_;
   
-  size_t ready_;
-  size_t done_;
-  
-  const Parameters* parameters_;
+  // Frames windowed by Process(), and played (or dropped) by Play(). At most
+  // two are waiting, and a third slot can still be held by Buffer() for a
+  // dropped frame.
+  std::atomic<size_t> recorded_;
+  size_t played_;
+  std::atomic<size_t> frame_state_[kNumFrameSlots];
+  float* frame_[kNumFrameSlots];
+
+  // The parameters at the end of the hop of each frame.
+  Parameters parameters_[kNumFrameSlots];
+
+  // Owned by Buffer(): the next frame it looks for.
+  size_t next_frame_;
   
   Modifier* modifier_;
   
@@ -0,0 +1,326 @@
+// Copyright 2026 agent.
+//
+// Author: agent (agent@local)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Real FFT for desktop CPUs, a drop-in replacement for stmlib::ShyFFT: same
+// methods, same spectrum layout (real parts of bins 0 to N/2, then negated
+// imaginary parts of bins 1 to N/2 - 1), and the input is used as workspace
+// too.
+//
+// The N-point real transform is a N/2-point complex transform of the even and
+// odd samples, followed by a split step. The complex transform is a radix-2
+// Stockham one: no bit reversal, and every pass reads and writes unit-stride
+// runs of the split real and imaginary arrays, which the butterflies process
+// 4 at a time. Twiddles come from a table instead of a recurrence.
+
+#ifndef CLOUDS_DSP_PVOC_STOCKHAM_FFT_H_
+#define CLOUDS_DSP_PVOC_STOCKHAM_FFT_H_
+
+#include "stmlib/stmlib.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "clouds/dsp/simd.h"
+
+namespace clouds {
+
+template<size_t size>
+class StockhamFFT {
+ public:
+  enum {
+    max_size = size
+  };
+
+  StockhamFFT() { }
+  ~StockhamFFT() { }
+
+  void Init() {
+    num_passes_ = 0;
+    for (size_t t = size; t > 1; t >>= 1) {
+      ++num_passes_;
+    }
+    // W^k = cos(2 pi k / size) - i sin(2 pi k / size).
+    for (size_t k = 0; k < size / 2; ++k) {
+      double phase = 2.0 * 3.141592653589793 * static_cast<double>(k) / size;
+      cos_[k] = static_cast<float>(cos(phase));
+      sin_[k] = static_cast<float>(sin(phase));
+    }
+  }
+
+  void Direct(float* input, float* output) {
+    Direct(input, output, num_passes_);
+  }
+
+  void Inverse(float* input, float* output) {
+    Inverse(input, output, num_passes_);
+  }
+
+  // Transforms 2^num_passes samples, with num_passes >= 3.
+  void Direct(float* input, float* output, size_t num_passes) {
+    size_t n = 1 << num_passes;
+    size_t m = n >> 1;
+    size_t stride = size / n;
+
+    // Even samples as the real part, odd samples as the imaginary part.
+    float* re = output;
+    float* im = output + m;
+    size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= m; i += 4) {
+      __m128 a = _mm_loadu_ps(&input[2 * i]);
+      __m128 b = _mm_loadu_ps(&input[2 * i + 4]);
+      _mm_storeu_ps(&re[i], _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(&im[i], _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#endif  // __SSE2__
+    for (; i < m; ++i) {
+      re[i] = input[2 * i];
+      im[i] = input[2 * i + 1];
+    }
+
+    float* z = Transform(re, im, input, input + m, m, stride);
+    float* zr = z;
+    float* zi = z + m;
+
+    // Split: X[k] = E[k] + W^k O[k], and X[m - k] = conj(E[k] - W^k O[k]),
+    // where E and O are the spectra of the even and odd samples. The pair
+    // (k, m - k) only reads and writes bins k and m - k, so this can run in
+    // place.
+    float r0 = zr[0];
+    float i0 = zi[0];
+    output[0] = r0 + i0;
+    output[m] = r0 - i0;
+    for (size_t k = 1; k <= m / 2; ++k) {
+      float a = zr[k];
+      float b = zi[k];
+      float c = zr[m - k];
+      float d = zi[m - k];
+      float er = 0.5f * (a + c);
+      float ei = 0.5f * (b - d);
+      float or_ = 0.5f * (b + d);
+      float oi = 0.5f * (c - a);
+      float w_cos = cos_[k * stride];
+      float w_sin = sin_[k * stride];
+      float tr = or_ * w_cos + oi * w_sin;
+      float ti = oi * w_cos - or_ * w_sin;
+      output[k] = er + tr;
+      output[m + k] = -(ei + ti);
+      if (k != m - k) {
+        output[m - k] = er - tr;
+        output[n - k] = ei - ti;
+      }
+    }
+  }
+
+  // Unnormalized: Inverse(Direct(x)) is n x. Same layout as Direct.
+  void Inverse(float* input, float* output, size_t num_passes) {
+    size_t n = 1 << num_passes;
+    size_t m = n >> 1;
+    size_t stride = size / n;
+
+    // Rebuild the spectrum of the complex signal made of the even and odd
+    // samples, twice as large so that the output comes out scaled by n.
+    float* re = output;
+    float* im = output + m;
+    float x0 = input[0];
+    float xm = input[m];
+    re[0] = x0 + xm;
+    im[0] = x0 - xm;
+    for (size_t k = 1; k <= m / 2; ++k) {
+      float a = input[k];
+      float b = -input[m + k];
+      float c = input[m - k];
+      float d = -input[n - k];
+      float er = a + c;
+      float ei = b - d;
+      float dr = a - c;
+      float di = b + d;
+      float w_cos = cos_[k * stride];
+      float w_sin = sin_[k * stride];
+      float or_ = dr * w_cos - di * w_sin;
+      float oi = dr * w_sin + di * w_cos;
+      re[k] = er - oi;
+      im[k] = ei + or_;
+      re[m - k] = er + oi;
+      im[m - k] = or_ - ei;
+    }
+
+    // The inverse transform is the direct one with the real and imaginary
+    // parts swapped on both sides.
+    float* z = Transform(im, re, input + m, input, m, stride);
+    float* zr = z == input + m ? input : output;
+    float* zi = z == input + m ? input + m : output + m;
+
+    if (zr == output) {
+      std::copy(&output[0], &output[n], &input[0]);
+      zr = input;
+      zi = input + m;
+    }
+    size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= m; i += 4) {
+      __m128 a = _mm_loadu_ps(&zr[i]);
+      __m128 b = _mm_loadu_ps(&zi[i]);
+      _mm_storeu_ps(&output[2 * i], _mm_unpacklo_ps(a, b));
+      _mm_storeu_ps(&output[2 * i + 4], _mm_unpackhi_ps(a, b));
+    }
+#endif  // __SSE2__
+    for (; i < m; ++i) {
+      output[2 * i] = zr[i];
+      output[2 * i + 1] = zi[i];
+    }
+  }
+
+ private:
+  // Complex transform of the m points in (xr, xi), using (yr, yi) as the
+  // other half of the ping-pong buffer. Returns the real part of the result,
+  // which is either xr or yr; the imaginary part is m floats after it in the
+  // same buffer, as long as the buffers are laid out that way.
+  float* Transform(
+      float* xr, float* xi,
+      float* yr, float* yi,
+      size_t m,
+      size_t stride) {
+    // Sub-transforms of length l, interleaved with a step of s.
+    for (size_t l = m, s = 1; l > 1; l >>= 1, s <<= 1) {
+      size_t h = l >> 1;
+      size_t twiddle_step = stride * s * 2;
+#if defined(__SSE2__) || defined(_M_X64)
+      if (s >= 4) {
+        for (size_t p = 0; p < h; ++p) {
+          __m128 w_cos = _mm_set1_ps(cos_[p * twiddle_step]);
+          __m128 w_sin = _mm_set1_ps(sin_[p * twiddle_step]);
+          const float* ar = &xr[s * p];
+          const float* ai = &xi[s * p];
+          const float* br = &xr[s * (p + h)];
+          const float* bi = &xi[s * (p + h)];
+          float* sum_r = &yr[s * 2 * p];
+          float* sum_i = &yi[s * 2 * p];
+          float* difference_r = &yr[s * (2 * p + 1)];
+          float* difference_i = &yi[s * (2 * p + 1)];
+          for (size_t q = 0; q < s; q += 4) {
+            __m128 a_r = _mm_loadu_ps(&ar[q]);
+            __m128 a_i = _mm_loadu_ps(&ai[q]);
+            __m128 b_r = _mm_loadu_ps(&br[q]);
+            __m128 b_i = _mm_loadu_ps(&bi[q]);
+            __m128 d_r = _mm_sub_ps(a_r, b_r);
+            __m128 d_i = _mm_sub_ps(a_i, b_i);
+            _mm_storeu_ps(&sum_r[q], _mm_add_ps(a_r, b_r));
+            _mm_storeu_ps(&sum_i[q], _mm_add_ps(a_i, b_i));
+            _mm_storeu_ps(&difference_r[q], _mm_add_ps(
+                _mm_mul_ps(d_r, w_cos), _mm_mul_ps(d_i, w_sin)));
+            _mm_storeu_ps(&difference_i[q], _mm_sub_ps(
+                _mm_mul_ps(d_i, w_cos), _mm_mul_ps(d_r, w_sin)));
+          }
+        }
+      } else if (s == 1 && h >= 4) {
+        // One butterfly per lane, results interleaved on the way out.
+        for (size_t p = 0; p < h; p += 4) {
+          __m128 w_cos = _mm_set_ps(
+              cos_[(p + 3) * twiddle_step], cos_[(p + 2) * twiddle_step],
+              cos_[(p + 1) * twiddle_step], cos_[p * twiddle_step]);
+          __m128 w_sin = _mm_set_ps(
+              sin_[(p + 3) * twiddle_step], sin_[(p + 2) * twiddle_step],
+              sin_[(p + 1) * twiddle_step], sin_[p * twiddle_step]);
+          __m128 a_r = _mm_loadu_ps(&xr[p]);
+          __m128 a_i = _mm_loadu_ps(&xi[p]);
+          __m128 b_r = _mm_loadu_ps(&xr[p + h]);
+          __m128 b_i = _mm_loadu_ps(&xi[p + h]);
+          __m128 s_r = _mm_add_ps(a_r, b_r);
+          __m128 s_i = _mm_add_ps(a_i, b_i);
+          __m128 d_r = _mm_sub_ps(a_r, b_r);
+          __m128 d_i = _mm_sub_ps(a_i, b_i);
+          __m128 t_r = _mm_add_ps(
+              _mm_mul_ps(d_r, w_cos), _mm_mul_ps(d_i, w_sin));
+          __m128 t_i = _mm_sub_ps(
+              _mm_mul_ps(d_i, w_cos), _mm_mul_ps(d_r, w_sin));
+          _mm_storeu_ps(&yr[2 * p], _mm_unpacklo_ps(s_r, t_r));
+          _mm_storeu_ps(&yr[2 * p + 4], _mm_unpackhi_ps(s_r, t_r));
+          _mm_storeu_ps(&yi[2 * p], _mm_unpacklo_ps(s_i, t_i));
+          _mm_storeu_ps(&yi[2 * p + 4], _mm_unpackhi_ps(s_i, t_i));
+        }
+      } else if (s == 2 && h >= 2) {
+        // Two butterflies of two sub-transforms per vector.
+        for (size_t p = 0; p < h; p += 2) {
+          float c0 = cos_[p * twiddle_step];
+          float c1 = cos_[(p + 1) * twiddle_step];
+          float s0 = sin_[p * twiddle_step];
+          float s1 = sin_[(p + 1) * twiddle_step];
+          __m128 w_cos = _mm_set_ps(c1, c1, c0, c0);
+          __m128 w_sin = _mm_set_ps(s1, s1, s0, s0);
+          __m128 a_r = _mm_loadu_ps(&xr[2 * p]);
+          __m128 a_i = _mm_loadu_ps(&xi[2 * p]);
+          __m128 b_r = _mm_loadu_ps(&xr[2 * (p + h)]);
+          __m128 b_i = _mm_loadu_ps(&xi[2 * (p + h)]);
+          __m128 s_r = _mm_add_ps(a_r, b_r);
+          __m128 s_i = _mm_add_ps(a_i, b_i);
+          __m128 d_r = _mm_sub_ps(a_r, b_r);
+          __m128 d_i = _mm_sub_ps(a_i, b_i);
+          __m128 t_r = _mm_add_ps(
+              _mm_mul_ps(d_r, w_cos), _mm_mul_ps(d_i, w_sin));
+          __m128 t_i = _mm_sub_ps(
+              _mm_mul_ps(d_i, w_cos), _mm_mul_ps(d_r, w_sin));
+          _mm_storeu_ps(&yr[4 * p], _mm_movelh_ps(s_r, t_r));
+          _mm_storeu_ps(&yr[4 * p + 4], _mm_movehl_ps(t_r, s_r));
+          _mm_storeu_ps(&yi[4 * p], _mm_movelh_ps(s_i, t_i));
+          _mm_storeu_ps(&yi[4 * p + 4], _mm_movehl_ps(t_i, s_i));
+        }
+      } else
+#endif  // __SSE2__
+      {
+        for (size_t p = 0; p < h; ++p) {
+          float w_cos = cos_[p * twiddle_step];
+          float w_sin = sin_[p * twiddle_step];
+          for (size_t q = 0; q < s; ++q) {
+            float a_r = xr[q + s * p];
+            float a_i = xi[q + s * p];
+            float b_r = xr[q + s * (p + h)];
+            float b_i = xi[q + s * (p + h)];
+            float d_r = a_r - b_r;
+            float d_i = a_i - b_i;
+            yr[q + s * 2 * p] = a_r + b_r;
+            yi[q + s * 2 * p] = a_i + b_i;
+            yr[q + s * (2 * p + 1)] = d_r * w_cos + d_i * w_sin;
+            yi[q + s * (2 * p + 1)] = d_i * w_cos - d_r * w_sin;
+          }
+        }
+      }
+      std::swap(xr, yr);
+      std::swap(xi, yi);
+    }
+    return xr;
+  }
+
+  size_t num_passes_;
+  float cos_[size / 2];
+  float sin_[size / 2];
+
+  DISALLOW_COPY_AND_ASSIGN(StockhamFFT);
+};
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_PVOC_STOCKHAM_FFT_H_
@@ -43,9 +43,13 @@ namespace clouds
   {
   public:
 
-    void Init() {
+    void Init(RandomGenerator* random) {
+      random_ = random;
+      phase_ = 0.0f;
+      phase_increment_ = 0.0f;
+      direction_ = false;
       value_ = 0.0f;
-      next_value_ = Random::GetFloat() * 2.0f - 1.0f;
+      next_value_ = random_->GetFloat() * 2.0f - 1.0f;
     }
 
     inline void set_slope(float slope) {
@@ -60,7 +64,7 @@ namespace clouds
         phase_--;
         value_ = next_value_;
         direction_ = !direction_;
-        float rnd = (1.0f - kOscillationMinimumGap) * Random::GetFloat() + kOscillationMinimumGap;
+        float rnd = (1.0f - kOscillationMinimumGap) * random_->GetFloat() + kOscillationMinimumGap;
         next_value_ = direction_ ?
           value_ + (1.0f - value_) * rnd :
           value_ - (1.0f + value_) * rnd;
@@ -71,6 +75,7 @@ namespace clouds
     }
 
   private:
+    RandomGenerator* random_;
     float phase_;
     float phase_increment_;
     float value_;
@@ -0,0 +1,259 @@
+// Copyright 2026 agent.
+//
+// Author: agent (agent@local)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// 
+// See http://creativecommons.org/licenses/MIT/ for more information.
+//
+// -----------------------------------------------------------------------------
+//
+// Vectorized interpolation and block kernels, with a scalar fallback.
+
+#ifndef CLOUDS_DSP_SIMD_H_
+#define CLOUDS_DSP_SIMD_H_
+
+#include "stmlib/stmlib.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace clouds {
+
+#if defined(__SSE2__) || defined(_M_X64)
+inline __m128 Hermite4(__m128 xm1, __m128 x0, __m128 x1, __m128 x2, __m128 t) {
+  __m128 half = _mm_set1_ps(0.5f);
+  __m128 c = _mm_mul_ps(_mm_sub_ps(x1, xm1), half);
+  __m128 v = _mm_sub_ps(x0, x1);
+  __m128 w = _mm_add_ps(c, v);
+  __m128 a = _mm_add_ps(
+      _mm_add_ps(w, v), _mm_mul_ps(_mm_sub_ps(x2, x0), half));
+  __m128 b_neg = _mm_add_ps(w, a);
+  __m128 x = _mm_sub_ps(_mm_mul_ps(a, t), b_neg);
+  x = _mm_add_ps(_mm_mul_ps(x, t), c);
+  return _mm_add_ps(_mm_mul_ps(x, t), x0);
+}
+#endif  // __SSE2__
+
+// Cubic Hermite interpolation of 4 independent taps, given the 4 samples
+// around each of them. Same operations, in the same order, as the scalar
+// Context::InterpolateHermite and AudioBuffer::ReadHermite, so both paths
+// give identical results.
+inline void HermiteBatch4(
+    const float* xm1,
+    const float* x0,
+    const float* x1,
+    const float* x2,
+    const float* t,
+    float* out) {
+#if defined(__SSE2__) || defined(_M_X64)
+  _mm_storeu_ps(out, Hermite4(
+      _mm_loadu_ps(xm1),
+      _mm_loadu_ps(x0),
+      _mm_loadu_ps(x1),
+      _mm_loadu_ps(x2),
+      _mm_loadu_ps(t)));
+#elif defined(__ARM_NEON)
+  float32x4_t vxm1 = vld1q_f32(xm1);
+  float32x4_t vx0 = vld1q_f32(x0);
+  float32x4_t vx1 = vld1q_f32(x1);
+  float32x4_t vx2 = vld1q_f32(x2);
+  float32x4_t vt = vld1q_f32(t);
+  float32x4_t half = vdupq_n_f32(0.5f);
+  float32x4_t c = vmulq_f32(vsubq_f32(vx1, vxm1), half);
+  float32x4_t v = vsubq_f32(vx0, vx1);
+  float32x4_t w = vaddq_f32(c, v);
+  float32x4_t a = vaddq_f32(
+      vaddq_f32(w, v), vmulq_f32(vsubq_f32(vx2, vx0), half));
+  float32x4_t b_neg = vaddq_f32(w, a);
+  float32x4_t x = vsubq_f32(vmulq_f32(a, vt), b_neg);
+  x = vaddq_f32(vmulq_f32(x, vt), c);
+  x = vaddq_f32(vmulq_f32(x, vt), vx0);
+  vst1q_f32(out, x);
+#else
+  for (int32_t i = 0; i < 4; ++i) {
+    float c = (x1[i] - xm1[i]) * 0.5f;
+    float v = x0[i] - x1[i];
+    float w = c + v;
+    float a = w + v + (x2[i] - x0[i]) * 0.5f;
+    float b_neg = w + a;
+    out[i] = (((a * t[i]) - b_neg) * t[i] + c) * t[i] + x0[i];
+  }
+#endif  // __SSE2__
+}
+
+// Same, for 8 taps.
+inline void HermiteBatch8(
+    const float* xm1,
+    const float* x0,
+    const float* x1,
+    const float* x2,
+    const float* t,
+    float* out) {
+#if defined(__AVX__)
+  __m256 vxm1 = _mm256_loadu_ps(xm1);
+  __m256 vx0 = _mm256_loadu_ps(x0);
+  __m256 vx1 = _mm256_loadu_ps(x1);
+  __m256 vx2 = _mm256_loadu_ps(x2);
+  __m256 vt = _mm256_loadu_ps(t);
+  __m256 half = _mm256_set1_ps(0.5f);
+  __m256 c = _mm256_mul_ps(_mm256_sub_ps(vx1, vxm1), half);
+  __m256 v = _mm256_sub_ps(vx0, vx1);
+  __m256 w = _mm256_add_ps(c, v);
+  __m256 a = _mm256_add_ps(
+      _mm256_add_ps(w, v), _mm256_mul_ps(_mm256_sub_ps(vx2, vx0), half));
+  __m256 b_neg = _mm256_add_ps(w, a);
+  __m256 x = _mm256_sub_ps(_mm256_mul_ps(a, vt), b_neg);
+  x = _mm256_add_ps(_mm256_mul_ps(x, vt), c);
+  x = _mm256_add_ps(_mm256_mul_ps(x, vt), vx0);
+  _mm256_storeu_ps(out, x);
+#else
+  HermiteBatch4(xm1, x0, x1, x2, t, out);
+  HermiteBatch4(xm1 + 4, x0 + 4, x1 + 4, x2 + 4, t + 4, out + 4);
+#endif  // __AVX__
+}
+
+// Reads 4 consecutive samples from a 16-bit circular buffer of the given
+// size, at the 16.16 fixed-point positions phase, phase + increment, ...
+// relative to first, with the given interpolation order (0: ZOH, 1: linear,
+// 3: Hermite). The samples are gathered and interpolated in parallel, with
+// the same operations and in the same order as AudioBuffer::Read().
+template<int32_t order>
+inline void ReadBatch4(
+    const int16_t* samples,
+    int32_t size,
+    int32_t first,
+    int32_t phase,
+    int32_t increment,
+    float* out) {
+#if defined(__SSE2__) || defined(_M_X64)
+  __m128i vphase = _mm_set_epi32(
+      phase + 3 * increment, phase + 2 * increment, phase + increment, phase);
+  __m128i vindex = _mm_add_epi32(
+      _mm_set1_epi32(first), _mm_srai_epi32(vphase, 16));
+  vindex = _mm_sub_epi32(vindex, _mm_and_si128(
+      _mm_cmpgt_epi32(vindex, _mm_set1_epi32(size - 1)),
+      _mm_set1_epi32(size)));
+  __m128 t = _mm_mul_ps(
+      _mm_cvtepi32_ps(_mm_and_si128(vphase, _mm_set1_epi32(65535))),
+      _mm_set1_ps(1.0f / 65536.0f));
+  
+  // Load the 4 samples following each read position, and transpose them so
+  // that x[k] holds the k-th sample of each of the 4 positions.
+  __m128 x[4];
+  for (int32_t i = 0; i < 4; ++i) {
+    __m128i s = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(
+        samples + _mm_cvtsi128_si32(vindex)));
+    x[i] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+    vindex = _mm_shuffle_epi32(vindex, _MM_SHUFFLE(0, 3, 2, 1));
+  }
+  _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+  
+  __m128 y;
+  if (order == 3) {
+    y = Hermite4(x[0], x[1], x[2], x[3], t);
+  } else if (order == 1) {
+    y = _mm_add_ps(x[0], _mm_mul_ps(_mm_sub_ps(x[1], x[0]), t));
+  } else {
+    y = x[0];
+  }
+  _mm_storeu_ps(out, _mm_mul_ps(y, _mm_set1_ps(1.0f / 32768.0f)));
+#else
+  for (int32_t i = 0; i < 4; ++i) {
+    int32_t index = first + (phase >> 16);
+    if (index >= size) {
+      index -= size;
+    }
+    const float xm1 = samples[index];
+    const float x0 = samples[index + 1];
+    const float t = static_cast<float>(phase & 65535) / 65536.0f;
+    float y;
+    if (order == 3) {
+      const float x1 = samples[index + 2];
+      const float x2 = samples[index + 3];
+      const float c = (x1 - xm1) * 0.5f;
+      const float v = x0 - x1;
+      const float w = c + v;
+      const float a = w + v + (x2 - x0) * 0.5f;
+      const float b_neg = w + a;
+      y = (((a * t) - b_neg) * t + c) * t + x0;
+    } else if (order == 1) {
+      y = xm1 + (x0 - xm1) * t;
+    } else {
+      y = xm1;
+    }
+    out[i] = y * (1.0f / 32768.0f);
+    phase += increment;
+  }
+#endif  // __SSE2__
+}
+
+// out[i] = a[i] * b[i].
+inline void MultiplyBlock(
+    const float* a,
+    const float* b,
+    float* out,
+    size_t size) {
+  size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 4 <= size; i += 4) {
+    vst1q_f32(out + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+  }
+#endif  // __SSE2__
+  for (; i < size; ++i) {
+    out[i] = a[i] * b[i];
+  }
+}
+
+// out[i] += a[i] * b[i], rounding the product first like the scalar loop
+// (no fused multiply-add).
+inline void MultiplyAddBlock(
+    const float* a,
+    const float* b,
+    float* out,
+    size_t size) {
+  size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  for (; i + 4 <= size; i += 4) {
+    __m128 product = _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), product));
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 4 <= size; i += 4) {
+    float32x4_t product = vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+    vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), product));
+  }
+#endif  // __SSE2__
+  for (; i < size; ++i) {
+    out[i] += a[i] * b[i];
+  }
+}
+
+}  // namespace clouds
+
+#endif  // CLOUDS_DSP_SIMD_H_
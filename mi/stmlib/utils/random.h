@@ -60,6 +60,39 @@ class Random {
   DISALLOW_COPY_AND_ASSIGN(Random);
 };
 
+// Same generator, with its own state. Gives every processor an independent
+// stream, which the static one cannot do when several instances run on
+// different threads.
+class RandomGenerator {
+ public:
+  RandomGenerator() { }
+  ~RandomGenerator() { }
+
+  inline uint32_t state() const { return state_; }
+
+  inline void Seed(uint32_t seed) {
+    state_ = seed;
+  }
+
+  inline uint32_t GetWord() {
+    state_ = state_ * 1664525L + 1013904223L;
+    return state();
+  }
+
+  inline int16_t GetSample() {
+    return static_cast<int16_t>(GetWord() >> 16);
+  }
+
+  inline float GetFloat() {
+    return static_cast<float>(GetWord()) / 4294967296.0f;
+  }
+
+ private:
+  uint32_t state_;
+
+  DISALLOW_COPY_AND_ASSIGN(RandomGenerator);
+};
+
 }  // namespace stmlib
 
 #endif  // STMLIB_UTILS_RANDOM_H_
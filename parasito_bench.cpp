@@ -0,0 +1,652 @@
+// Headless renderer and benchmark for the parasito~ DSP.
+//
+// Streams a WAV (16/24/32-bit PCM or 32-bit float) or a raw interleaved
+// stereo float32 file through clouds::GranularProcessor, once per
+// configuration (playback mode x quality x Oliverb on/off), and reports
+// ns/sample, real-time factor (processing time / audio duration) and the
+// worst block time. Without an input file, a deterministic test signal is
+// rendered instead.
+//
+// usage: parasito_bench [-i file.wav|file.raw] [-r samplerate] [-b blocksize]
+//                       [-s seconds] [-n repeats] [-o output_prefix] [-p]
+//
+// -p renders through the planar Process() overload instead of the
+// interleaved FloatFrame one. -V runs several independent voices on the same
+// input, like the channels of mc.parasito~, and -T spreads them over worker
+// threads; the output is the first voice's. -S moves the FFTs of the
+// spectral mode to the shared scheduler, as @spectral_thread does.
+
+#include "clouds/dsp/granular_processor.h"
+#include "clouds/dsp/pvoc/stockham_fft.h"
+#include "stmlib/fft/shy_fft.h"
+#include "stmlib/utils/random.h"
+#include "parasito_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const char* mode_names[] = { "granular", "stretch", "looping", "spectral", "oliverb" };
+
+static const int LARGE_BUF = 118784;
+static const int SMALL_BUF = 65536 - 128;
+
+struct t_bench_config {
+	clouds::PlaybackMode mode;
+	int32_t quality;
+	bool oliverb;
+};
+
+// Memory layout, as in the external: the module's sizes by default, or
+// buffer_seconds of 16-bit audio per channel plus the FX workspace.
+struct t_bench_memory {
+	size_t large;
+	size_t small;
+	clouds::Format reverb_format;
+};
+
+// Grain count (0 for the module's), CPU budget of the quality adaptation
+// (0 to disable it), shared by all the voices, seed of the random streams,
+// and density parameter.
+struct t_bench_grains {
+	int32_t num_grains;
+	float cpu_budget;
+	uint32_t seed;
+	float density;
+};
+
+// Voices rendered side by side, and worker threads sharing them with the
+// main thread, or the shared scheduler rendering them one block late. The
+// scheduler can also take the spectral mode's FFTs off the main thread.
+struct t_bench_voices {
+	long num_voices;
+	long num_threads;
+	bool parallel;
+	bool spectral_thread;
+};
+
+// State of one voice, and the block it is working on.
+struct t_bench_voice {
+	clouds::GranularProcessor processor;
+	uint8_t* large_buf;
+	uint8_t* small_buf;
+	uint8_t* reverb_buf;
+	std::vector<clouds::FloatFrame> ibuf;
+	std::vector<clouds::FloatFrame> obuf;
+	std::vector<float> planar_buf;
+};
+
+struct t_bench_block {
+	t_bench_voice* voices;
+	const float* input;
+	size_t start;
+	size_t size;
+	bool planar;
+};
+
+struct t_bench_result {
+	double total_ns;
+	double peak_block_ns;
+	float degradation;
+};
+
+static uint32_t read_u32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_u16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+static bool read_file(const char* path, std::vector<uint8_t>* data) {
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		return false;
+	}
+	uint8_t chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+		data->insert(data->end(), chunk, chunk + n);
+	}
+	fclose(fp);
+	return true;
+}
+
+// Decodes a RIFF/WAVE file to interleaved stereo float. Mono files are
+// duplicated on both channels, extra channels are dropped.
+static bool load_wav(const std::vector<uint8_t>& data, std::vector<float>* out, double* samplerate) {
+	if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) || memcmp(&data[8], "WAVE", 4)) {
+		return false;
+	}
+	uint16_t format = 0, channels = 0, bits = 0;
+	const uint8_t* samples = NULL;
+	size_t samples_size = 0;
+
+	size_t pos = 12;
+	while (pos + 8 <= data.size()) {
+		const uint8_t* chunk = &data[pos];
+		size_t chunk_size = read_u32(chunk + 4);
+		size_t available = std::min(chunk_size, data.size() - pos - 8);
+		if (!memcmp(chunk, "fmt ", 4) && available >= 16) {
+			format = read_u16(chunk + 8);
+			channels = read_u16(chunk + 10);
+			*samplerate = read_u32(chunk + 12);
+			bits = read_u16(chunk + 22);
+			if (format == 0xfffe && available >= 26) {
+				format = read_u16(chunk + 32);
+			}
+		} else if (!memcmp(chunk, "data", 4)) {
+			samples = chunk + 8;
+			samples_size = available;
+		}
+		pos += 8 + chunk_size + (chunk_size & 1);
+	}
+
+	bool pcm = format == 1 && (bits == 16 || bits == 24 || bits == 32);
+	bool ieee = format == 3 && bits == 32;
+	if (!samples || !channels || (!pcm && !ieee)) {
+		return false;
+	}
+
+	size_t bytes = bits / 8;
+	size_t frames = samples_size / (bytes * channels);
+	out->resize(frames * 2);
+	for (size_t i = 0; i < frames; i++) {
+		for (int ch = 0; ch < 2; ch++) {
+			const uint8_t* p = samples + (i * channels + std::min<int>(ch, channels - 1)) * bytes;
+			float v;
+			if (ieee) {
+				uint32_t u = read_u32(p);
+				memcpy(&v, &u, sizeof(v));
+			} else if (bits == 16) {
+				v = (int16_t)read_u16(p) / 32768.0f;
+			} else if (bits == 24) {
+				int32_t s = (p[0] << 8) | (p[1] << 16) | ((uint32_t)p[2] << 24);
+				v = (s >> 8) / 8388608.0f;
+			} else {
+				v = (int32_t)read_u32(p) / 2147483648.0f;
+			}
+			(*out)[i * 2 + ch] = v;
+		}
+	}
+	return true;
+}
+
+// Raw files are interleaved stereo float32, native endianness.
+static void load_raw(const std::vector<uint8_t>& data, std::vector<float>* out) {
+	out->resize(data.size() / (2 * sizeof(float)) * 2);
+	if (!out->empty()) {
+		memcpy(&(*out)[0], &data[0], out->size() * sizeof(float));
+	}
+}
+
+// Decaying plucks over a slow chord, so that every engine has something
+// with transients and sustained material to chew on.
+static void synthesize(std::vector<float>* out, double samplerate, double seconds) {
+	size_t frames = (size_t)(samplerate * seconds);
+	out->resize(frames * 2);
+	uint32_t rng = 0x21;
+	size_t pluck_period = (size_t)(samplerate / 4);
+	for (size_t i = 0; i < frames; i++) {
+		double t = i / samplerate;
+		double env = std::exp(-8.0 * (i % pluck_period) / samplerate);
+		rng = rng * 1664525L + 1013904223L;
+		double noise = ((int32_t)rng) / 2147483648.0;
+		double l = 0.2 * std::sin(2 * M_PI * 220.0 * t) + 0.1 * std::sin(2 * M_PI * 330.0 * t);
+		double r = 0.2 * std::sin(2 * M_PI * 277.2 * t) + 0.1 * std::sin(2 * M_PI * 440.0 * t);
+		(*out)[i * 2] = (float)(l + 0.3 * env * noise);
+		(*out)[i * 2 + 1] = (float)(r + 0.3 * env * noise);
+	}
+}
+
+static void bench_voice_init(t_bench_voice* voice, const t_bench_config& config, double samplerate,
+		size_t blocksize, const t_bench_memory& memory, const t_bench_grains& grains, uint32_t seed) {
+	voice->large_buf = new uint8_t[memory.large];
+	voice->small_buf = new uint8_t[memory.small];
+	clouds::Format reverb_format = memory.reverb_format;
+	size_t reverb_buf_size = clouds::Oliverb::memory_size(reverb_format);
+	voice->reverb_buf = new uint8_t[reverb_buf_size];
+	voice->ibuf.resize(blocksize);
+	voice->obuf.resize(blocksize);
+	voice->planar_buf.resize(blocksize * 4);
+
+	// Renders must not depend on what ran before them.
+	memset(voice->large_buf, 0, memory.large);
+	memset(voice->small_buf, 0, memory.small);
+
+	clouds::GranularProcessor* processor = &voice->processor;
+	processor->Init(voice->large_buf, memory.large, voice->small_buf, memory.small, voice->reverb_buf, reverb_format);
+	processor->sample_rate(samplerate);
+	processor->set_playback_mode(config.mode);
+	processor->set_quality(config.quality);
+	processor->set_max_num_grains(grains.num_grains);
+	processor->set_random_seed(seed);
+
+	clouds::Parameters* p = processor->mutable_parameters();
+	memset(p, 0, sizeof(*p));
+	p->position = 0.3f;
+	p->size = 0.5f;
+	p->density = grains.density;
+	p->texture = 0.5f;
+	p->dry_wet = 1.0f;
+	p->stereo_spread = 0.5f;
+	p->feedback = 0.2f;
+	p->reverb = config.oliverb ? 0.7f : 0.0f;
+	p->oliverb_diffusion = 0.7f;
+	p->oliverb_size = 0.5f;
+	p->oliverb_mod_rate = 0.3f;
+	p->oliverb_mod_amount = 0.3f;
+	p->oliverb_density = 0.6f;
+	p->oliverb_texture = 0.5f;
+}
+
+static void bench_voice_free(t_bench_voice* voice) {
+	delete[] voice->reverb_buf;
+	delete[] voice->small_buf;
+	delete[] voice->large_buf;
+}
+
+static void bench_voice_process(void* context, long v) {
+	t_bench_block* block = (t_bench_block*)context;
+	t_bench_voice* voice = &block->voices[v];
+	size_t n = block->size;
+	size_t blocksize = voice->ibuf.size();
+	float* in_l = &voice->planar_buf[0];
+	float* in_r = in_l + blocksize;
+	float* out_l = in_r + blocksize;
+	float* out_r = out_l + blocksize;
+	for (size_t i = 0; i < n; i++) {
+		voice->ibuf[i].l = in_l[i] = block->input[(block->start + i) * 2];
+		voice->ibuf[i].r = in_r[i] = block->input[(block->start + i) * 2 + 1];
+	}
+	if (block->planar) {
+		voice->processor.Process(in_l, in_r, out_l, out_r, n);
+		for (size_t i = 0; i < n; i++) {
+			voice->obuf[i].l = out_l[i];
+			voice->obuf[i].r = out_r[i];
+		}
+	} else {
+		voice->processor.Process(&voice->ibuf[0], &voice->obuf[0], n);
+	}
+}
+
+static void bench_voice_spectral(void* context, long v) {
+	t_bench_block* block = (t_bench_block*)context;
+	block->voices[v].processor.ProcessSpectralFrames();
+}
+
+static t_bench_result bench_run(const t_bench_config& config, const std::vector<float>& input,
+		double samplerate, size_t blocksize, bool planar, const t_bench_memory& memory,
+		const t_bench_grains& grains, const t_bench_voices& voices, t_parasito_pool* pool,
+		t_parasito_scheduler* scheduler, std::vector<float>* output) {
+	bool parallel = scheduler && voices.parallel;
+	bool spectral_thread = scheduler && !voices.parallel && voices.spectral_thread;
+	std::vector<t_bench_voice> voice(voices.num_voices);
+	for (long v = 0; v < voices.num_voices; v++) {
+		bench_voice_init(&voice[v], config, samplerate, blocksize, memory, grains,
+			grains.seed + ((uint32_t)v << 16));
+		voice[v].processor.set_defer_spectral_frames(spectral_thread);
+	}
+
+	t_bench_block block = { &voice[0], &input[0], 0, 0, planar };
+	std::vector<t_parasito_task> tasks(voices.num_voices);
+	std::vector<t_parasito_task> spectral_tasks(voices.num_voices);
+	for (long v = 0; v < voices.num_voices; v++) {
+		tasks[v].job = bench_voice_process;
+		tasks[v].context = &block;
+		tasks[v].index = v;
+		tasks[v].done.store(true);
+		spectral_tasks[v].job = bench_voice_spectral;
+		spectral_tasks[v].context = &block;
+		spectral_tasks[v].index = v;
+		spectral_tasks[v].done.store(true);
+	}
+	t_bench_result result = { 0.0, 0.0, 0.0f };
+	size_t frames = input.size() / 2;
+	output->resize(frames * 2);
+	// Time of the previous block, as a fraction of its share of the budget.
+	float load = 0.0f;
+	size_t load_size = 0;
+	for (size_t start = 0; start < frames + (parallel ? blocksize : 0); start += blocksize) {
+		// With the scheduler, the block time is the wait for the previous
+		// block plus the submission of this one, as in the external.
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		if (parallel) {
+			for (long v = 0; v < voices.num_voices; v++) {
+				parasito_scheduler_wait(scheduler, &tasks[v]);
+				result.degradation = std::max(result.degradation, voice[v].processor.degradation());
+			}
+			for (size_t i = 0; start && i < block.size; i++) {
+				(*output)[(block.start + i) * 2] = voice[0].obuf[i].l;
+				(*output)[(block.start + i) * 2 + 1] = voice[0].obuf[i].r;
+			}
+			if (start >= frames) {
+				break;
+			}
+		}
+		// The voices are idle: the quality controller gets the time the
+		// previous block took for all of them, as in the external.
+		for (long v = 0; load_size && v < voices.num_voices; v++) {
+			voice[v].processor.ReportLoad(load, load_size);
+		}
+		block.start = start;
+		block.size = std::min(blocksize, frames - start);
+
+		// Prepare() is the control-rate job and runs off the audio thread in
+		// the external, so it is not part of the block time.
+		std::chrono::steady_clock::time_point t_prepare = std::chrono::steady_clock::now();
+		for (long v = 0; v < voices.num_voices; v++) {
+			voice[v].processor.Prepare();
+		}
+		std::chrono::steady_clock::time_point t_process = std::chrono::steady_clock::now();
+		if (parallel) {
+			for (long v = 0; v < voices.num_voices; v++) {
+				parasito_scheduler_submit(scheduler, &tasks[v]);
+			}
+		} else {
+			parasito_pool_run(pool, bench_voice_process, &block, voices.num_voices);
+		}
+		// The FFTs of the hops completed by this block, unless the previous
+		// ones are still running.
+		for (long v = 0; spectral_thread && v < voices.num_voices; v++) {
+			if (spectral_tasks[v].done.load(std::memory_order_acquire) &&
+					voice[v].processor.spectral_frames_pending()) {
+				parasito_scheduler_submit(scheduler, &spectral_tasks[v]);
+			}
+		}
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+		double ns = std::chrono::duration<double, std::nano>(t1 - t_process + (t_prepare - t0)).count();
+		result.total_ns += ns;
+		result.peak_block_ns = std::max(result.peak_block_ns, ns);
+		if (grains.cpu_budget > 0.0f) {
+			load = (float)(ns / (block.size / samplerate * 1e9 * grains.cpu_budget));
+			load_size = block.size;
+		}
+		if (parallel) {
+			continue;
+		}
+		for (long v = 0; v < voices.num_voices; v++) {
+			result.degradation = std::max(result.degradation, voice[v].processor.degradation());
+		}
+
+		for (size_t i = 0; i < block.size; i++) {
+			(*output)[(start + i) * 2] = voice[0].obuf[i].l;
+			(*output)[(start + i) * 2 + 1] = voice[0].obuf[i].r;
+		}
+	}
+
+	for (long v = 0; v < voices.num_voices; v++) {
+		if (spectral_thread) {
+			parasito_scheduler_wait(scheduler, &spectral_tasks[v]);
+		}
+		bench_voice_free(&voice[v]);
+	}
+	return result;
+}
+
+// Times one FFT backend on a direct and an inverse transform per hop of the
+// input, like STFT::Buffer() does them. The first spectrum is kept to compare
+// the backends.
+template<typename T>
+static double bench_fft(T* fft, const std::vector<float>& input, int repeats, std::vector<float>* spectrum) {
+	size_t n = clouds::kMaxFftSize;
+	size_t hop = n / clouds::kHopRatio;
+	size_t frames = input.size() / 2;
+	size_t hops = std::max<size_t>(frames / hop, 1);
+	std::vector<float> in(n), out(n);
+	fft->Init();
+	double best_ns = 0.0;
+	for (int r = 0; r < repeats; r++) {
+		double ns = 0.0;
+		for (size_t h = 0; h < hops; h++) {
+			for (size_t i = 0; i < n; i++) {
+				in[i] = input[((h * hop + i) % frames) * 2];
+			}
+			std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+			fft->Direct(&in[0], &out[0]);
+			std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+			if (h == 0) {
+				*spectrum = out;
+			}
+			in = out;
+			std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+			fft->Inverse(&in[0], &out[0]);
+			std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
+			ns += std::chrono::duration<double, std::nano>((t1 - t0) + (t3 - t2)).count();
+		}
+		if (r == 0 || ns < best_ns) {
+			best_ns = ns;
+		}
+	}
+	return best_ns / hops;
+}
+
+static void bench_ffts(const std::vector<float>& input, int repeats) {
+#ifdef USE_STOCKHAM_FFT
+	const char* built = "stockham";
+#else
+	const char* built = "shy";
+#endif  // USE_STOCKHAM_FFT
+	printf("# FFT backends, %zu points, direct + inverse per hop, spectral mode built with %s\n",
+		clouds::kMaxFftSize, built);
+	printf("%-9s %10s %10s\n", "backend", "us/hop", "max_err");
+
+	static stmlib::ShyFFT<float, clouds::kMaxFftSize, stmlib::RotationPhasor> shy;
+	static clouds::StockhamFFT<clouds::kMaxFftSize> stockham;
+	std::vector<float> reference, spectrum;
+	double ns = bench_fft(&shy, input, repeats, &reference);
+	printf("%-9s %10.2f %10s\n", "shy", ns / 1000.0, "-");
+
+	// Error relative to the largest bin of the module's FFT.
+	ns = bench_fft(&stockham, input, repeats, &spectrum);
+	float peak = 0.0f, error = 0.0f;
+	for (size_t i = 0; i < reference.size(); i++) {
+		peak = std::max(peak, fabsf(reference[i]));
+		error = std::max(error, fabsf(reference[i] - spectrum[i]));
+	}
+	printf("%-9s %10.2f %10.2e\n", "stockham", ns / 1000.0, peak > 0.0f ? error / peak : 0.0f);
+}
+
+static void usage() {
+	fprintf(stderr,
+		"usage: parasito_bench [-i file.wav|file.raw] [-r samplerate] [-b blocksize]\n"
+		"                      [-s seconds] [-n repeats] [-o output_prefix] [-m buffer_seconds]\n"
+		"                      [-g grains] [-c cpu_budget] [-R seed] [-d density] [-V voices]\n"
+		"                      [-T threads] [-P] [-S] [-p] [-f] [-F]\n"
+		"  -g  number of grains in granular mode (16-1024)\n"
+		"  -c  fraction of the block duration all voices may take before grain quality is lowered\n"
+		"  -R  seed of the random streams (default 33)\n"
+		"  -d  density parameter, 0 to 1 (default 0.7)\n"
+		"  -V  number of voices rendered side by side (default 1)\n"
+		"  -T  worker threads sharing the voices (default 0)\n"
+		"  -P  render the voices on the shared scheduler, one block late\n"
+		"  -S  run the spectral mode's FFTs on the shared scheduler (without -P)\n"
+		"  -p  planar I/O\n"
+		"  -f  32-bit float reverb memory\n"
+		"  -F  compare the FFT backends of the spectral mode instead\n");
+}
+
+int main(int argc, char** argv) {
+	const char* input_path = NULL;
+	const char* output_prefix = NULL;
+	double samplerate = 48000.0;
+	bool samplerate_set = false;
+	size_t blocksize = clouds::kMaxBlockSize;
+	double seconds = 10.0;
+	int repeats = 3;
+	bool planar = false;
+	double buffer_seconds = 0.0;
+	t_bench_memory memory = { LARGE_BUF, SMALL_BUF, clouds::FORMAT_16_BIT };
+	t_bench_grains grains = { 0, 0.0f, 0x21, 0.7f };
+	t_bench_voices voices = { 1, 0, false, false };
+	bool ffts = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (!strcmp(arg, "-p")) {
+			planar = true;
+			continue;
+		}
+		if (!strcmp(arg, "-F")) {
+			ffts = true;
+			continue;
+		}
+		if (!strcmp(arg, "-P")) {
+			voices.parallel = true;
+			continue;
+		}
+		if (!strcmp(arg, "-S")) {
+			voices.spectral_thread = true;
+			continue;
+		}
+		if (!strcmp(arg, "-f")) {
+			memory.reverb_format = clouds::FORMAT_32_BIT;
+			continue;
+		}
+		if (arg[0] != '-' || !value) {
+			usage();
+			return 1;
+		}
+		switch (arg[1]) {
+			case 'i': input_path = value; break;
+			case 'o': output_prefix = value; break;
+			case 'r': samplerate = atof(value); samplerate_set = true; break;
+			case 'b': blocksize = atoi(value); break;
+			case 's': seconds = atof(value); break;
+			case 'n': repeats = atoi(value); break;
+			case 'm': buffer_seconds = atof(value); break;
+			case 'g': grains.num_grains = atoi(value); break;
+			case 'c': grains.cpu_budget = atof(value); break;
+			case 'R': grains.seed = strtoul(value, NULL, 0); break;
+			case 'd': grains.density = atof(value); break;
+			case 'V': voices.num_voices = atol(value); break;
+			case 'T': voices.num_threads = atol(value); break;
+			default: usage(); return 1;
+		}
+		i++;
+	}
+	if (blocksize < 1 || samplerate <= 0 || repeats < 1 || voices.num_voices < 1) {
+		fprintf(stderr, "blocksize, samplerate, repeats and voices must be positive\n");
+		return 1;
+	}
+
+	std::vector<float> input;
+	if (input_path) {
+		std::vector<uint8_t> data;
+		if (!read_file(input_path, &data)) {
+			fprintf(stderr, "cannot read %s\n", input_path);
+			return 1;
+		}
+		double file_samplerate = samplerate;
+		if (load_wav(data, &input, &file_samplerate)) {
+			if (!samplerate_set) {
+				samplerate = file_samplerate;
+			}
+		} else if (!memcmp(&data[0], "RIFF", std::min<size_t>(4, data.size()))) {
+			fprintf(stderr, "unsupported WAV format in %s\n", input_path);
+			return 1;
+		} else {
+			load_raw(data, &input);
+		}
+	} else {
+		synthesize(&input, samplerate, seconds);
+	}
+
+	size_t frames = input.size() / 2;
+	if (!frames) {
+		fprintf(stderr, "empty input\n");
+		return 1;
+	}
+	double audio_ns = frames / samplerate * 1e9;
+
+	if (ffts) {
+		bench_ffts(input, repeats);
+		return 0;
+	}
+
+	if (buffer_seconds > 0) {
+		size_t samples = (size_t)(buffer_seconds * samplerate) + kInterpolationTail;
+		memory.small = (samples * sizeof(int16_t) + 15) & ~(size_t)15;
+		memory.large = memory.small + clouds::kFxWorkspaceSize;
+	}
+
+	printf("# %zu frames @ %.0f Hz, block %zu, %s I/O, %s reverb, best of %d\n",
+		frames, samplerate, blocksize, planar ? "planar" : "interleaved",
+		memory.reverb_format == clouds::FORMAT_32_BIT ? "float" : "16-bit", repeats);
+	printf("# %zu bytes of sample memory per channel\n", memory.small);
+	if (grains.num_grains || grains.cpu_budget > 0) {
+		printf("# %d grains, cpu budget %.2f\n", grains.num_grains, grains.cpu_budget);
+	}
+	if (grains.density != 0.7f) {
+		printf("# density %.2f\n", grains.density);
+	}
+#ifdef CLOUDS_SCALAR_GRAINS
+	printf("# scalar grain reads\n");
+#endif  // CLOUDS_SCALAR_GRAINS
+	if (voices.parallel) {
+		printf("# %ld voices on the shared scheduler, times spent by the main thread\n", voices.num_voices);
+	} else if (voices.num_voices > 1 || voices.num_threads) {
+		printf("# %ld voices, %ld worker threads, times for all voices\n", voices.num_voices, voices.num_threads);
+	}
+	if (voices.spectral_thread && !voices.parallel) {
+		printf("# spectral FFTs on the shared scheduler, times spent by the main thread\n");
+	}
+	printf("%-9s %-7s %-7s %10s %8s %12s %6s\n", "mode", "quality", "oliverb", "ns/sample", "rtf", "peak_us", "degr");
+
+	t_parasito_pool* pool = voices.num_threads > 0 && !voices.parallel ? parasito_pool_new(voices.num_threads) : NULL;
+	t_parasito_scheduler* scheduler = voices.parallel || voices.spectral_thread ? parasito_scheduler_acquire() : NULL;
+	std::vector<float> output;
+	for (int mode = 0; mode < clouds::PLAYBACK_MODE_LAST; mode++) {
+		for (int32_t quality = 0; quality < 4; quality++) {
+			for (int oliverb = 0; oliverb < 2; oliverb++) {
+				t_bench_config config = { (clouds::PlaybackMode)mode, quality, oliverb != 0 };
+				t_bench_result best = { 0.0, 0.0, 0.0f };
+				for (int r = 0; r < repeats; r++) {
+					t_bench_result result = bench_run(config, input, samplerate, blocksize, planar, memory, grains,
+						voices, pool, scheduler, &output);
+					if (r == 0 || result.total_ns < best.total_ns) {
+						best.total_ns = result.total_ns;
+					}
+					if (r == 0 || result.peak_block_ns < best.peak_block_ns) {
+						best.peak_block_ns = result.peak_block_ns;
+					}
+					best.degradation = std::max(best.degradation, result.degradation);
+				}
+
+				static const char* quality_names[] = { "st-hi", "mo-hi", "st-lo", "mo-lo" };
+				printf("%-9s %-7s %-7s %10.2f %8.4f %12.2f %6.2f\n",
+					mode_names[mode], quality_names[quality], oliverb ? "on" : "off",
+					best.total_ns / frames, best.total_ns / audio_ns, best.peak_block_ns / 1000.0,
+					best.degradation);
+
+				if (output_prefix) {
+					std::string path = std::string(output_prefix) + "_" + mode_names[mode] + "_"
+						+ quality_names[quality] + (oliverb ? "_verb" : "") + ".raw";
+					FILE* fp = fopen(path.c_str(), "wb");
+					if (!fp) {
+						fprintf(stderr, "cannot write %s\n", path.c_str());
+						parasito_pool_free(pool);
+						if (scheduler) {
+							parasito_scheduler_release(scheduler);
+						}
+						return 1;
+					}
+					fwrite(&output[0], sizeof(float), output.size(), fp);
+					fclose(fp);
+				}
+			}
+		}
+	}
+	parasito_pool_free(pool);
+	if (scheduler) {
+		parasito_scheduler_release(scheduler);
+	}
+	return 0;
+}
@@ -0,0 +1,456 @@
+// Worker threads for parasito~.
+//
+// t_parasito_pool is a fork-join pool for the voices of one object:
+// parasito_pool_run() hands out jobs 0..num_jobs-1 to the worker threads and
+// to the calling thread, and returns when all of them are done. The workers
+// spin for a moment, then sleep between runs; the caller helps with the
+// jobs, then spins until the ones taken by the workers are finished. The
+// caller, usually the audio thread, never takes a lock: runs are published
+// with atomics, and sleeping workers are woken with a semaphore.
+//
+// t_parasito_scheduler is shared by all the objects of a process, for work
+// that may finish later: tasks are submitted from any thread, run on one
+// worker per spare core, and waited for individually. The workers are not
+// pinned: the host's audio threads are not either, and the OS knows better
+// where they run.
+
+#ifndef PARASITO_POOL_H_
+#define PARASITO_POOL_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <errno.h>
+#include <semaphore.h>
+#endif
+
+typedef void (*t_parasito_job)(void* context, long index);
+
+// Counting semaphore of the OS. Posting never blocks, and shares no lock
+// with the sleeping threads, so the audio thread can wake the workers.
+struct t_parasito_semaphore {
+#if defined(_WIN32)
+	HANDLE handle;
+#elif defined(__APPLE__)
+	dispatch_semaphore_t handle;
+#else
+	sem_t handle;
+#endif
+};
+
+inline void parasito_semaphore_init(t_parasito_semaphore* semaphore) {
+#if defined(_WIN32)
+	semaphore->handle = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+#elif defined(__APPLE__)
+	semaphore->handle = dispatch_semaphore_create(0);
+#else
+	sem_init(&semaphore->handle, 0, 0);
+#endif
+}
+
+inline void parasito_semaphore_destroy(t_parasito_semaphore* semaphore) {
+#if defined(_WIN32)
+	CloseHandle(semaphore->handle);
+#elif defined(__APPLE__)
+	dispatch_release(semaphore->handle);
+#else
+	sem_destroy(&semaphore->handle);
+#endif
+}
+
+inline void parasito_semaphore_post(t_parasito_semaphore* semaphore, long count) {
+#if defined(_WIN32)
+	ReleaseSemaphore(semaphore->handle, count, NULL);
+#else
+	for (long i = 0; i < count; i++) {
+#if defined(__APPLE__)
+		dispatch_semaphore_signal(semaphore->handle);
+#else
+		sem_post(&semaphore->handle);
+#endif
+	}
+#endif
+}
+
+inline void parasito_semaphore_wait(t_parasito_semaphore* semaphore) {
+#if defined(_WIN32)
+	WaitForSingleObject(semaphore->handle, INFINITE);
+#elif defined(__APPLE__)
+	dispatch_semaphore_wait(semaphore->handle, DISPATCH_TIME_FOREVER);
+#else
+	while (sem_wait(&semaphore->handle) == -1 && errno == EINTR) {
+	}
+#endif
+}
+
+// Rounds of yield() before an idle worker goes to sleep.
+static const long kParasitoSpinRounds = 64;
+
+struct t_parasito_pool {
+	std::vector<std::thread> threads;
+
+	// The current run, published like a seqlock: the generation is odd while
+	// the run is being written. Jobs are numbered from the start of the pool,
+	// [first_job, end_job) for the current run, and claimed one at a time, so
+	// that a worker late for a run can never take a job of the next one.
+	std::atomic<unsigned long> generation;
+	std::atomic<t_parasito_job> job;
+	std::atomic<void*> context;
+	std::atomic<int64_t> first_job;
+	std::atomic<int64_t> end_job;
+
+	std::atomic<int64_t> next_job;
+	std::atomic<int64_t> jobs_done;
+
+	std::atomic<bool> quit;
+	std::atomic<long> sleeping_workers;
+	t_parasito_semaphore wake;
+};
+
+inline void parasito_pool_drain(t_parasito_pool* pool, t_parasito_job job, void* context, int64_t first_job, int64_t end_job) {
+	int64_t i = pool->next_job.load(std::memory_order_relaxed);
+	while (i < end_job) {
+		if (pool->next_job.compare_exchange_weak(i, i + 1, std::memory_order_relaxed)) {
+			job(context, (long)(i - first_job));
+			pool->jobs_done.fetch_add(1, std::memory_order_release);
+			i = pool->next_job.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+inline void parasito_pool_work(t_parasito_pool* pool) {
+	unsigned long seen = 0;
+	long idle = 0;
+	while (!pool->quit.load(std::memory_order_relaxed)) {
+		unsigned long generation = pool->generation.load(std::memory_order_acquire);
+		if (generation == seen || (generation & 1)) {
+			if (++idle < kParasitoSpinRounds) {
+				std::this_thread::yield();
+				continue;
+			}
+			// Sleep, unless a run came in meanwhile. Pairs with the run's
+			// generation store and sleeping_workers load: either the worker sees
+			// the run, or the caller sees the sleeping worker and wakes it. A
+			// wake-up that turns out unneeded only costs a round of the loop.
+			pool->sleeping_workers.fetch_add(1, std::memory_order_seq_cst);
+			if (pool->generation.load(std::memory_order_seq_cst) == seen &&
+					!pool->quit.load(std::memory_order_relaxed)) {
+				parasito_semaphore_wait(&pool->wake);
+			}
+			pool->sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+			idle = 0;
+			continue;
+		}
+		t_parasito_job job = pool->job.load(std::memory_order_relaxed);
+		void* context = pool->context.load(std::memory_order_relaxed);
+		int64_t first_job = pool->first_job.load(std::memory_order_relaxed);
+		int64_t end_job = pool->end_job.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (pool->generation.load(std::memory_order_relaxed) != generation) {
+			continue;
+		}
+		seen = generation;
+		idle = 0;
+		parasito_pool_drain(pool, job, context, first_job, end_job);
+	}
+}
+
+// Not real-time safe: call from the main thread.
+inline t_parasito_pool* parasito_pool_new(long num_threads) {
+	t_parasito_pool* pool = new t_parasito_pool;
+	pool->generation.store(0);
+	pool->job.store(NULL);
+	pool->context.store(NULL);
+	pool->first_job.store(0);
+	pool->end_job.store(0);
+	pool->next_job.store(0);
+	pool->jobs_done.store(0);
+	pool->quit.store(false);
+	pool->sleeping_workers.store(0);
+	parasito_semaphore_init(&pool->wake);
+	for (long i = 0; i < num_threads; i++) {
+		pool->threads.push_back(std::thread(parasito_pool_work, pool));
+	}
+	return pool;
+}
+
+inline void parasito_pool_free(t_parasito_pool* pool) {
+	if (!pool) {
+		return;
+	}
+	pool->quit.store(true, std::memory_order_seq_cst);
+	parasito_semaphore_post(&pool->wake, (long)pool->threads.size());
+	for (size_t i = 0; i < pool->threads.size(); i++) {
+		pool->threads[i].join();
+	}
+	parasito_semaphore_destroy(&pool->wake);
+	delete pool;
+}
+
+// Without a pool or workers, the jobs run in order on the calling thread.
+// Runs of one pool must not overlap.
+inline void parasito_pool_run(t_parasito_pool* pool, t_parasito_job job, void* context, long num_jobs) {
+	if (!pool || pool->threads.empty() || num_jobs < 2) {
+		for (long i = 0; i < num_jobs; i++) {
+			job(context, i);
+		}
+		return;
+	}
+	// All the jobs of the previous run were claimed: they start here.
+	int64_t first_job = pool->end_job.load(std::memory_order_relaxed);
+	int64_t end_job = first_job + num_jobs;
+	unsigned long generation = pool->generation.load(std::memory_order_relaxed);
+	pool->generation.store(generation + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	pool->job.store(job, std::memory_order_relaxed);
+	pool->context.store(context, std::memory_order_relaxed);
+	pool->first_job.store(first_job, std::memory_order_relaxed);
+	pool->end_job.store(end_job, std::memory_order_relaxed);
+	pool->generation.store(generation + 2, std::memory_order_seq_cst);
+	long sleeping = pool->sleeping_workers.load(std::memory_order_seq_cst);
+	if (sleeping) {
+		parasito_semaphore_post(&pool->wake, std::min(sleeping, num_jobs - 1));
+	}
+	parasito_pool_drain(pool, job, context, first_job, end_job);
+	while (pool->jobs_done.load(std::memory_order_acquire) < end_job) {
+		std::this_thread::yield();
+	}
+}
+
+static const size_t kParasitoTaskQueueSize = 1024;
+
+struct t_parasito_task {
+	t_parasito_job job;
+	void* context;
+	long index;
+	std::atomic<bool> done;
+};
+
+// Bounded multi-producer, multi-consumer queue of tasks (D. Vyukov's): each
+// cell carries a sequence number telling whether it is free for the
+// producer at a given position, or full for the consumer at that position.
+struct t_parasito_task_queue {
+	struct t_cell {
+		std::atomic<size_t> sequence;
+		t_parasito_task* task;
+	};
+	t_cell cells[kParasitoTaskQueueSize];
+	std::atomic<size_t> enqueue_position;
+	std::atomic<size_t> dequeue_position;
+};
+
+inline void parasito_task_queue_init(t_parasito_task_queue* queue) {
+	for (size_t i = 0; i < kParasitoTaskQueueSize; i++) {
+		queue->cells[i].sequence.store(i, std::memory_order_relaxed);
+		queue->cells[i].task = NULL;
+	}
+	queue->enqueue_position.store(0, std::memory_order_relaxed);
+	queue->dequeue_position.store(0, std::memory_order_relaxed);
+}
+
+inline bool parasito_task_queue_push(t_parasito_task_queue* queue, t_parasito_task* task) {
+	size_t position = queue->enqueue_position.load(std::memory_order_relaxed);
+	t_parasito_task_queue::t_cell* cell;
+	while (true) {
+		cell = &queue->cells[position & (kParasitoTaskQueueSize - 1)];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+		if (difference == 0) {
+			if (queue->enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			return false;
+		} else {
+			position = queue->enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+	cell->task = task;
+	cell->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+inline t_parasito_task* parasito_task_queue_pop(t_parasito_task_queue* queue) {
+	size_t position = queue->dequeue_position.load(std::memory_order_relaxed);
+	t_parasito_task_queue::t_cell* cell;
+	while (true) {
+		cell = &queue->cells[position & (kParasitoTaskQueueSize - 1)];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+		if (difference == 0) {
+			if (queue->dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			return NULL;
+		} else {
+			position = queue->dequeue_position.load(std::memory_order_relaxed);
+		}
+	}
+	t_parasito_task* task = cell->task;
+	cell->sequence.store(position + kParasitoTaskQueueSize, std::memory_order_release);
+	return task;
+}
+
+// Each worker has its own queue, which the submitters fill in turn. A worker
+// runs the tasks of its queue first, then steals from the others, and so do
+// the threads waiting for a task.
+struct t_parasito_scheduler {
+	std::vector<std::thread> threads;
+	t_parasito_task_queue* queues;
+	long num_queues;
+	std::atomic<unsigned long> next_queue;
+	std::atomic<bool> quit;
+
+	std::atomic<long> sleeping_workers;
+	t_parasito_semaphore wake;
+
+	// Number of objects using the scheduler, guarded by
+	// parasito_scheduler_instances_lock().
+	long references;
+};
+
+inline t_parasito_task* parasito_scheduler_steal(t_parasito_scheduler* scheduler, long first_queue) {
+	for (long i = 0; i < scheduler->num_queues; i++) {
+		t_parasito_task* task = parasito_task_queue_pop(&scheduler->queues[(first_queue + i) % scheduler->num_queues]);
+		if (task) {
+			return task;
+		}
+	}
+	return NULL;
+}
+
+inline void parasito_scheduler_run_task(t_parasito_task* task) {
+	task->job(task->context, task->index);
+	task->done.store(true, std::memory_order_release);
+}
+
+inline void parasito_scheduler_work(t_parasito_scheduler* scheduler, long queue) {
+	long idle = 0;
+	while (!scheduler->quit.load(std::memory_order_relaxed)) {
+		t_parasito_task* task = parasito_scheduler_steal(scheduler, queue);
+		if (task) {
+			parasito_scheduler_run_task(task);
+			idle = 0;
+			continue;
+		}
+		if (++idle < kParasitoSpinRounds) {
+			std::this_thread::yield();
+			continue;
+		}
+		// Sleep, unless a task came in meanwhile. The fence pairs with the one
+		// in parasito_scheduler_submit: either the worker sees the task, or
+		// the submitter sees the sleeping worker and posts the semaphore. A
+		// post that turns out unneeded only costs a round of the loop.
+		scheduler->sleeping_workers.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		task = parasito_scheduler_steal(scheduler, queue);
+		if (!task && !scheduler->quit.load(std::memory_order_relaxed)) {
+			parasito_semaphore_wait(&scheduler->wake);
+		}
+		scheduler->sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+		if (task) {
+			parasito_scheduler_run_task(task);
+		}
+		idle = 0;
+	}
+}
+
+inline std::mutex& parasito_scheduler_instances_lock() {
+	static std::mutex lock;
+	return lock;
+}
+
+inline t_parasito_scheduler*& parasito_scheduler_instance() {
+	static t_parasito_scheduler* scheduler = NULL;
+	return scheduler;
+}
+
+// Returns the scheduler of the process, started with one worker per spare
+// core by its first user. Not real-time safe: call from the main thread.
+inline t_parasito_scheduler* parasito_scheduler_acquire() {
+	std::lock_guard<std::mutex> guard(parasito_scheduler_instances_lock());
+	t_parasito_scheduler*& scheduler = parasito_scheduler_instance();
+	if (!scheduler) {
+		long num_cores = (long)std::thread::hardware_concurrency();
+		long num_workers = num_cores > 1 ? num_cores - 1 : 1;
+		scheduler = new t_parasito_scheduler;
+		scheduler->queues = new t_parasito_task_queue[num_workers];
+		for (long i = 0; i < num_workers; i++) {
+			parasito_task_queue_init(&scheduler->queues[i]);
+		}
+		scheduler->num_queues = num_workers;
+		scheduler->next_queue.store(0);
+		scheduler->quit.store(false);
+		scheduler->sleeping_workers.store(0);
+		parasito_semaphore_init(&scheduler->wake);
+		scheduler->references = 0;
+		for (long i = 0; i < num_workers; i++) {
+			scheduler->threads.push_back(std::thread(parasito_scheduler_work, scheduler, i));
+		}
+	}
+	scheduler->references++;
+	return scheduler;
+}
+
+// The workers stop with the last user, which must have waited for its tasks.
+inline void parasito_scheduler_release(t_parasito_scheduler* scheduler) {
+	std::lock_guard<std::mutex> guard(parasito_scheduler_instances_lock());
+	if (--scheduler->references) {
+		return;
+	}
+	scheduler->quit.store(true, std::memory_order_seq_cst);
+	parasito_semaphore_post(&scheduler->wake, (long)scheduler->threads.size());
+	for (size_t i = 0; i < scheduler->threads.size(); i++) {
+		scheduler->threads[i].join();
+	}
+	parasito_semaphore_destroy(&scheduler->wake);
+	delete[] scheduler->queues;
+	delete scheduler;
+	parasito_scheduler_instance() = NULL;
+}
+
+// Queues a task, or runs it right away when all the queues are full.
+inline void parasito_scheduler_submit(t_parasito_scheduler* scheduler, t_parasito_task* task) {
+	task->done.store(false, std::memory_order_relaxed);
+	unsigned long first = scheduler->next_queue.fetch_add(1, std::memory_order_relaxed);
+	for (long i = 0; i < scheduler->num_queues; i++) {
+		if (parasito_task_queue_push(&scheduler->queues[(first + i) % scheduler->num_queues], task)) {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (scheduler->sleeping_workers.load(std::memory_order_relaxed)) {
+				parasito_semaphore_post(&scheduler->wake, 1);
+			}
+			return;
+		}
+	}
+	parasito_scheduler_run_task(task);
+}
+
+// Runs queued tasks, whoever submitted them, until this one is done.
+inline void parasito_scheduler_wait(t_parasito_scheduler* scheduler, t_parasito_task* task) {
+	while (!task->done.load(std::memory_order_acquire)) {
+		t_parasito_task* other = parasito_scheduler_steal(scheduler, 0);
+		if (other) {
+			parasito_scheduler_run_task(other);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+#endif  // PARASITO_POOL_H_
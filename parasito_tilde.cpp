@@ -1,5 +1,8 @@
 #include "c74_msp.h"
 #include "clouds/dsp/granular_processor.h"
+#include "parasito_pool.h"
+#include <atomic>
+#include <chrono>
 #include <iostream>
 
 using namespace c74::max;
@@ -7,11 +10,77 @@ using namespace c74::max;
 static const char* clds_version = "0.5"; 
 
 static t_class* this_class = nullptr;
+static t_class* mc_class = nullptr;
+static uint32_t instance_count = 0;
+// Objects alive, which share @cpu_budget.
+static std::atomic<long> live_instances(0);
 
 inline double constrain(double v, double vMin, double vMax) {
 	return std::max<double>(vMin, std::min<double>(vMax, v));
 }
 
+// Parameters that can be set per voice with "setvalue", clipped and scaled
+// like the messages of the same name. The first kNumModulationInlets also
+// have a signal inlet after the two audio inputs, in this order. While one is
+// connected, it replaces the messages for its parameter: its mean over each
+// slice of clouds::kMaxBlockSize samples is clipped and scaled the same way.
+struct t_parameter_message {
+	const char* name;
+	clouds::ParameterId id;
+	double min;
+	double max;
+	double scale;
+	const char* assist;
+};
+
+static const t_parameter_message parameter_messages[] = {
+	{ "position", clouds::PARAMETER_POSITION, 0.0, 1.0, 1.0, "(signal) Position" },
+	{ "grain_size", clouds::PARAMETER_SIZE, 0.0, 1.0, 1.0, "(signal) Grain size" },
+	{ "grain_pitch", clouds::PARAMETER_PITCH, -48.0, 48.0, 1.0, "(signal) Grain pitch (semitones)" },
+	{ "grain_density", clouds::PARAMETER_DENSITY, 0.0, 1.0, 1.0, "(signal) Grain density" },
+	{ "grain_texture", clouds::PARAMETER_TEXTURE, 0.0, 1.0, 1.0, "(signal) Grain texture" },
+	{ "mix", clouds::PARAMETER_DRY_WET, 0.0, 1.0, 1.0, "(signal) Mix" },
+	{ "reverb", clouds::PARAMETER_REVERB, 0.0, 1.0, 1.0, "(signal) Reverb" },
+	{ "diffusion", clouds::PARAMETER_OLIVERB_DIFFUSION, 0.0, 1.0, 1.0, "(signal) Diffusion" },
+	{ "size", clouds::PARAMETER_OLIVERB_SIZE, 0.0, 1.0, 1.0, "(signal) Size" },
+	{ "mod_rate", clouds::PARAMETER_OLIVERB_MOD_RATE, 0.0, 1.0, 1.0, "(signal) Mod rate" },
+	{ "mod_amount", clouds::PARAMETER_OLIVERB_MOD_AMOUNT, 0.0, 1.0, 1.0, "(signal) Mod amount" },
+	{ "ratio", clouds::PARAMETER_OLIVERB_RATIO, -1.0, 1.0, 12.0, "(signal) Ratio" },
+	{ "pitch", clouds::PARAMETER_OLIVERB_PITCH, -1.0, 1.0, 1.0, "(signal) Pitch" },
+	{ "density", clouds::PARAMETER_OLIVERB_DENSITY, 0.0, 1.0, 1.0, "(signal) Density" },
+	{ "texture", clouds::PARAMETER_OLIVERB_TEXTURE, 0.0, 1.0, 1.0, "(signal) Texture" },
+	{ "spread", clouds::PARAMETER_STEREO_SPREAD, 0.0, 1.0, 1.0, NULL },
+	{ "feedback", clouds::PARAMETER_FEEDBACK, 0.0, 1.0, 1.0, NULL },
+	{ "freeze", clouds::PARAMETER_FREEZE, 0.0, 1.0, 1.0, NULL },
+	{ "bang", clouds::PARAMETER_TRIGGER, 1.0, 1.0, 1.0, NULL },
+};
+
+static const int kNumModulationInlets = 15;
+static const int kNumParameterMessages = sizeof(parameter_messages) / sizeof(parameter_messages[0]);
+static const int kNumInlets = 2 + kNumModulationInlets;
+static const long kMaxVoices = 64;
+
+// One Clouds voice: a processor, and the parameters last sent to it.
+struct t_parasito_voice {
+	clouds::GranularProcessor processor;
+	// Sent again by parasito_resync when the queue overflowed (e.g. while
+	// the DSP was off).
+	float parameter_values[clouds::PARAMETER_LAST];
+
+	// Where the voice reads and writes the current vector: the signal
+	// vectors, or in parallel mode its copies in job_buf.
+	const double* inputs[kNumInlets];
+	double* outputs[2];
+	long frames;
+	// Parallel mode: kNumInlets input vectors followed by 2 output vectors,
+	// of job_frames samples each, and the task rendering them.
+	double* job_buf;
+	t_parasito_task task;
+	bool task_submitted;
+	// With @spectral_thread, the task running the spectral mode's FFTs.
+	t_parasito_task spectral_task;
+};
+
 struct t_parasito {
 	t_pxobject m_obj;
 
@@ -35,79 +104,613 @@ struct t_parasito {
 	double f_lofi;
 	double f_num_channels;
 
-	clouds::GranularProcessor processor;
+	// The voices sit side by side in one array, and their recording buffers
+	// side by side in one block of memory: voice v uses the large buffer at
+	// v * voice_buf_size, followed by its small buffer.
+	t_parasito_voice* voices;
+	long     l_voices;
+	// Worker threads sharing the voices with the audio thread, 0 to run all
+	// of them on the audio thread.
+	long     l_threads;
+	t_parasito_pool* pool;
+	// Parallel mode renders the voices on the scheduler shared by all the
+	// instances, one vector late.
+	long     l_parallel;
+	// Otherwise, the scheduler can take the FFTs of the spectral mode off the
+	// audio thread, within the hop of slack of the phase vocoder.
+	long     l_spectral_thread;
+	t_parasito_scheduler* scheduler;
+	double*  job_memory;
+	long     job_frames;
+
+	t_qelem* prepare_qelem;
+	// Parameter changes go through the processors' queues, which take one
+	// writer at a time: messages can come from the main and scheduler threads.
+	t_critical queue_lock;
+	std::atomic<bool> parameters_dropped;
+	t_qelem* resync_qelem;
+	// Connected modulation inlets, from the count[] of the last dsp64.
+	int      modulated_inlets[kNumModulationInlets];
+	int      num_modulated_inlets;
+	bool     parameter_modulated[clouds::PARAMETER_LAST];
+	// First channel and number of channels of each inlet in the perform
+	// routine's inputs.
+	long     inlet_offsets[kNumInlets];
+	long     inlet_channels[kNumInlets];
 	bool ltrig;
-	clouds::FloatFrame* ibuf;
-	clouds::FloatFrame* obuf;
-	int iobufsz;
 
 /*	static const int LARGE_BUF = 524288;
 	static const int SMALL_BUF = 262144;*/
 	static const int LARGE_BUF = 118784;
 	static const int SMALL_BUF = 65536 - 128;
-	uint8_t* large_buf;
-	int      large_buf_size;
-	uint8_t* small_buf;
-	int      small_buf_size;
+	uint8_t* memory;
+	size_t   large_buf_size;
+	size_t   small_buf_size;
+	uint8_t* reverb_memory;
+	size_t   reverb_buf_size;
+
+	// Recording length, 0 for the module's memory (about 1s in stereo).
+	double   f_buffer_seconds;
+	double   buffer_samplerate;
+	// Buffers waiting to replace the ones above, see parasito_prepare.
+	uint8_t* next_memory;
+	size_t   next_large_buf_size;
+	size_t   next_small_buf_size;
+
+	// Grains in granular mode, 0 for the module's count.
+	long     l_grains;
+	// Share of the vector duration after which grain quality is lowered,
+	// split between all the objects, and the time the last vector took
+	// against this object's part of it.
+	double   f_cpu_budget;
+	std::atomic<double> cpu_budget;
+	double   load;
+	long     load_frames;
+	// Seed of the random streams. With @cpu_budget 0, renders with the same
+	// seed are identical; otherwise the grains depend on the CPU load.
+	long     l_seed;
 };
 
+// Voice v of an inlet reads channel v of its multichannel signal, wrapping
+// around when the inlet has fewer channels than there are voices.
+inline double* parasito_inlet(t_parasito* self, double** ins, int inlet, long voice) {
+	return ins[self->inlet_offsets[inlet] + voice % self->inlet_channels[inlet]];
+}
+
+void parasito_perform_voice(void* context, long v) {
+	t_parasito* self = (t_parasito*)context;
+	t_parasito_voice* voice = &self->voices[v];
+	clouds::GranularProcessor* processor = &voice->processor;
+	const double* in = voice->inputs[0];
+	const double* in2 = voice->inputs[1];
+	double* out = voice->outputs[0];
+	double* out2 = voice->outputs[1];
+	long sampleframes = voice->frames;
+
+	// The planar path reads and writes the signal vectors directly, and can
+	// run in place when Max hands out the same vector for inlet and outlet.
+	if (!self->num_modulated_inlets) {
+		processor->Process(in, in2, out, out2, sampleframes);
+	} else {
+		// Parameters belong to the thread rendering the voice, the audio
+		// thread or a worker: Prepare() leaves them alone. Each slice reads
+		// its modulation before writing its output, so outlets can share
+		// vectors with the modulation inlets too.
+		clouds::Parameters* parameters = processor->mutable_parameters();
+		for (long start = 0; start < sampleframes; start += clouds::kMaxBlockSize) {
+			long size = std::min<long>(sampleframes - start, clouds::kMaxBlockSize);
+			for (int i = 0; i < self->num_modulated_inlets; ++i) {
+				const t_parameter_message& inlet = parameter_messages[self->modulated_inlets[i]];
+				const double* signal = voice->inputs[2 + self->modulated_inlets[i]] + start;
+				double sum = 0.0;
+				for (long j = 0; j < size; ++j) {
+					sum += signal[j];
+				}
+				clouds::ParameterEvent event;
+				event.time = 0;
+				event.id = inlet.id;
+				event.value = constrain(sum / size, inlet.min, inlet.max) * inlet.scale;
+				clouds::ApplyParameterEvent(event, parameters);
+			}
+			processor->Process(in + start, in2 + start, out + start, out2 + start, size);
+		}
+	}
+}
+
+void parasito_spectral_voice(void* context, long v) {
+	t_parasito* self = (t_parasito*)context;
+	self->voices[v].processor.ProcessSpectralFrames();
+}
+
+// Waits for the voices' tasks still in flight, from any thread.
+void parasito_join(t_parasito* self) {
+	for (long v = 0; v < self->l_voices; ++v) {
+		t_parasito_voice* voice = &self->voices[v];
+		if (voice->task_submitted) {
+			parasito_scheduler_wait(self->scheduler, &voice->task);
+			voice->task_submitted = false;
+		}
+	}
+}
+
+// Same for the FFTs, which can still be using the recording buffers.
+void parasito_join_spectral(t_parasito* self) {
+	for (long v = 0; self->l_spectral_thread && v < self->l_voices; ++v) {
+		parasito_scheduler_wait(self->scheduler, &self->voices[v].spectral_task);
+	}
+}
+
+// Each voice outputs what its task rendered during the previous vector, and
+// starts on a copy of this one. The tasks run on the shared scheduler while
+// the rest of the DSP chain runs; whatever is left when the next vector comes
+// is finished by the audio thread in parasito_join.
+void parasito_perform_parallel(t_parasito* self, double** ins, double** outs, long sampleframes) {
+	parasito_join(self);
+	if (sampleframes > self->job_frames) {
+		for (long i = 0; i < 2 * self->l_voices; ++i) {
+			std::fill(outs[i], outs[i] + sampleframes, 0.0);
+		}
+		return;
+	}
+
+	// All the inputs are copied before any output is written, since outlets
+	// may share vectors with the inlets of any voice.
+	for (long v = 0; v < self->l_voices; ++v) {
+		t_parasito_voice* voice = &self->voices[v];
+		for (int i = 0; i < 2 + self->num_modulated_inlets; ++i) {
+			int inlet = i < 2 ? i : 2 + self->modulated_inlets[i - 2];
+			double* copy = voice->job_buf + inlet * self->job_frames;
+			const double* signal = parasito_inlet(self, ins, inlet, v);
+			std::copy(signal, signal + sampleframes, copy);
+			voice->inputs[inlet] = copy;
+		}
+	}
+	for (long v = 0; v < self->l_voices; ++v) {
+		t_parasito_voice* voice = &self->voices[v];
+		double* rendered[2] = {
+			voice->job_buf + kNumInlets * self->job_frames,
+			voice->job_buf + (kNumInlets + 1) * self->job_frames
+		};
+		for (int i = 0; i < 2; ++i) {
+			if (voice->frames == sampleframes) {
+				std::copy(rendered[i], rendered[i] + sampleframes, outs[i * self->l_voices + v]);
+			} else {
+				std::fill(outs[i * self->l_voices + v], outs[i * self->l_voices + v] + sampleframes, 0.0);
+			}
+			voice->outputs[i] = rendered[i];
+		}
+		voice->frames = sampleframes;
+		voice->task_submitted = true;
+		parasito_scheduler_submit(self->scheduler, &voice->task);
+	}
+}
+
+// Graceful degradation follows the time the whole perform routine takes, on
+// the audio thread, against this object's share of @cpu_budget: all the
+// objects run one after the other in the same callback. The voices get the
+// load of a vector at the next one, while none of them is running.
+void parasito_report_load(t_parasito* self) {
+	for (long v = 0; self->load_frames && v < self->l_voices; ++v) {
+		self->voices[v].processor.ReportLoad((float)self->load, self->load_frames);
+	}
+}
 
+void parasito_measure_load(t_parasito* self, std::chrono::steady_clock::time_point start, long sampleframes) {
+	double budget = self->cpu_budget.load(std::memory_order_relaxed);
+	if (budget > 0.0) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		long objects = std::max<long>(live_instances.load(std::memory_order_relaxed), 1);
+		self->load = elapsed.count() * self->buffer_samplerate * objects / (sampleframes * budget);
+	} else {
+		// Lets the quality recover.
+		self->load = 0.0;
+	}
+	self->load_frames = sampleframes;
+}
 
 void parasito_perform64(t_parasito* self, t_object* dsp64, double** ins, long numins, double** outs, long numouts, long sampleframes, long flags, void* userparam) {
-    double    *in = ins[0];     // first inlet
-    double    *in2 = ins[1];     // first inlet
-    double    *out = outs[0];   // first outlet
-    double    *out2 = outs[1];   // first outlet
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (self->l_parallel) {
+		parasito_join(self);
+	}
+	parasito_report_load(self);
+	if (self->l_parallel) {
+		parasito_perform_parallel(self, ins, outs, sampleframes);
+	} else {
+		for (long v = 0; v < self->l_voices; ++v) {
+			t_parasito_voice* voice = &self->voices[v];
+			for (int i = 0; i < kNumInlets; ++i) {
+				voice->inputs[i] = parasito_inlet(self, ins, i, v);
+			}
+			voice->outputs[0] = outs[v];
+			voice->outputs[1] = outs[self->l_voices + v];
+			voice->frames = sampleframes;
+		}
+		parasito_pool_run(self->pool, parasito_perform_voice, self, self->l_voices);
+
+		// The FFTs of the hops completed by this vector, unless the previous
+		// ones are still running: they are due by the end of the next hop.
+		for (long v = 0; self->l_spectral_thread && v < self->l_voices; ++v) {
+			t_parasito_voice* voice = &self->voices[v];
+			if (voice->spectral_task.done.load(std::memory_order_acquire) &&
+				voice->processor.spectral_frames_pending()) {
+				parasito_scheduler_submit(self->scheduler, &voice->spectral_task);
+			}
+		}
+	}
+
+	parasito_measure_load(self, start, sampleframes);
 
-	if (sampleframes > self->iobufsz) {
-		self->iobufsz = sampleframes;
-		self->ibuf = new clouds::FloatFrame[self->iobufsz];
-		self->obuf = new clouds::FloatFrame[self->iobufsz];
-		self->processor.reset_buffers();
+	// Buffer (re)allocation and mode switches never run here: the processors
+	// stay silent until parasito_prepare has done the work on the main thread.
+	for (long v = 0; v < self->l_voices; ++v) {
+		if (self->voices[v].processor.prepare_pending()) {
+			qelem_set(self->prepare_qelem);
+			break;
+		}
+	}
+	if (self->parameters_dropped.load(std::memory_order_relaxed)) {
+		qelem_set(self->resync_qelem);
 	}
+}
 
-	for (auto i=0; i<self->iobufsz; i++){
-		self->ibuf[i].l = *in++;
-		self->ibuf[i].r = *in2++;
+// Voice -1 stands for all of them.
+void parasito_queue_voice(t_parasito* x, long voice, clouds::ParameterId id, double value) {
+	critical_enter(x->queue_lock);
+	for (long v = 0; v < x->l_voices; ++v) {
+		if (voice != -1 && voice != v) {
+			continue;
+		}
+		x->voices[v].parameter_values[id] = (float)value;
+		if (!x->parameter_modulated[id] && !x->voices[v].processor.QueueParameter(id, (float)value)) {
+			x->parameters_dropped.store(true, std::memory_order_relaxed);
+		}
 	}
+	critical_exit(x->queue_lock);
+}
 
-	self->processor.Prepare();
-	self->processor.Process(self->ibuf, self->obuf, self->iobufsz);
+void parasito_queue(t_parasito* x, clouds::ParameterId id, double value) {
+	parasito_queue_voice(x, -1, id, value);
+}
 
-	for (int i = 0; i < self->iobufsz; i++) {
-		*out++ = self->obuf[i].l;
-        *out2++ = self->obuf[i].r;
+// The queues have been drained by the audio thread: the latest values
+// replace the changes that did not fit. Missed triggers are not replayed.
+void parasito_resync(t_parasito* self) {
+	critical_enter(self->queue_lock);
+	self->parameters_dropped.store(false, std::memory_order_relaxed);
+	for (long v = 0; v < self->l_voices; ++v) {
+		t_parasito_voice* voice = &self->voices[v];
+		for (int i = 0; i < clouds::PARAMETER_LAST; ++i) {
+			if (i != clouds::PARAMETER_TRIGGER && !self->parameter_modulated[i] &&
+				!voice->processor.QueueParameter((clouds::ParameterId)i, voice->parameter_values[i])) {
+				self->parameters_dropped.store(true, std::memory_order_relaxed);
+			}
+		}
 	}
+	critical_exit(self->queue_lock);
+}
 
+void parasito_prepare(t_parasito* self) {
+	// New recording buffers are swapped in once the audio thread has let go
+	// of every voice, and the old ones can go right away. Until then, no voice
+	// is prepared: the others hand over their engines at their next block.
+	if (self->next_memory) {
+		for (long v = 0; v < self->l_voices; ++v) {
+			if (!self->voices[v].processor.prepare_pending()) {
+				return;
+			}
+		}
+		parasito_join_spectral(self);
+		size_t stride = self->next_large_buf_size + self->next_small_buf_size;
+		for (long v = 0; v < self->l_voices; ++v) {
+			uint8_t* large_buf = self->next_memory + v * stride;
+			self->voices[v].processor.set_buffers(large_buf, self->next_large_buf_size,
+				large_buf + self->next_large_buf_size, self->next_small_buf_size);
+		}
+		delete[] self->memory;
+		self->memory = self->next_memory;
+		self->large_buf_size = self->next_large_buf_size;
+		self->small_buf_size = self->next_small_buf_size;
+		self->next_memory = NULL;
+	}
+	for (long v = 0; v < self->l_voices; ++v) {
+		self->voices[v].processor.Prepare();
+	}
 }
 
-void* parasito_new(void) {
-	t_parasito* self = (t_parasito*)object_alloc(this_class);
-	outlet_new(self, "signal");
-	outlet_new(self, "signal");
-	inlet_new(self, NULL);
+// f_buffer_seconds of 16-bit audio per channel (4 times as much in lofi,
+// which stores 8-bit mu-law at half the sample rate), plus the FX workspace,
+// or the module's memory when it is 0.
+void parasito_buffer_sizes(t_parasito* self, size_t* large, size_t* small) {
+	if (self->f_buffer_seconds <= 0) {
+		*large = t_parasito::LARGE_BUF;
+		*small = t_parasito::SMALL_BUF;
+		return;
+	}
+	size_t samples = (size_t)(self->f_buffer_seconds * self->buffer_samplerate) + kInterpolationTail;
+	*small = (samples * sizeof(int16_t) + 15) & ~(size_t)15;
+	*large = *small + clouds::kFxWorkspaceSize;
+}
 
-	dsp_setup((t_pxobject*)self, 2);
+// Allocates buffers for the current length and sample rate. The processors
+// still use the old ones until parasito_prepare swaps them.
+void parasito_realloc_buffers(t_parasito* self) {
+	size_t large, small;
+	parasito_buffer_sizes(self, &large, &small);
+	if (self->next_memory) {
+		if (large == self->next_large_buf_size && small == self->next_small_buf_size) {
+			return;
+		}
+		delete[] self->next_memory;
+		self->next_memory = NULL;
+	}
+	if (large == self->large_buf_size && small == self->small_buf_size) {
+		return;
+	}
+	self->next_memory = new uint8_t[(large + small) * self->l_voices];
+	self->next_large_buf_size = large;
+	self->next_small_buf_size = small;
+	for (long v = 0; v < self->l_voices; ++v) {
+		self->voices[v].processor.reset_buffers();
+	}
+}
 
-	self->iobufsz = 64;
-	self->ibuf = new clouds::FloatFrame[self->iobufsz];
-	self->obuf = new clouds::FloatFrame[self->iobufsz];
-	self->large_buf_size = t_parasito::LARGE_BUF;
-	self->large_buf = new uint8_t[self->large_buf_size];
-	self->small_buf_size = t_parasito::SMALL_BUF;
-	self->small_buf = new uint8_t[self->small_buf_size];
+t_max_err parasito_buffer_seconds_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		self->f_buffer_seconds = constrain(atom_getfloat(argv), 0.0, 600.0);
+		// During parasito_new, the buffers are allocated after the attributes
+		// have been read.
+		if (self->memory) {
+			parasito_realloc_buffers(self);
+		}
+	}
+	return MAX_ERR_NONE;
+}
 
-	self->processor.Init(self->large_buf,self->LARGE_BUF,self->small_buf,self->SMALL_BUF);
-	self->processor.mutable_parameters()->dry_wet = 1.0f;
+t_max_err parasito_grains_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		long grains = atom_getlong(argv);
+		self->l_grains = grains > 0 ? (long)constrain(grains, clouds::kMinNumGrains, clouds::kMaxNumGrains) : 0;
+		for (long v = 0; v < self->l_voices; ++v) {
+			self->voices[v].processor.set_max_num_grains(self->l_grains);
+		}
+	}
+	return MAX_ERR_NONE;
+}
+
+t_max_err parasito_cpu_budget_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		self->f_cpu_budget = constrain(atom_getfloat(argv), 0.0, 1.0);
+		self->cpu_budget.store(self->f_cpu_budget, std::memory_order_relaxed);
+	}
+	return MAX_ERR_NONE;
+}
+
+// Voice 0 uses the seed itself, the others seeds far from those of the
+// neighbouring instances.
+void parasito_seed_voices(t_parasito* self) {
+	for (long v = 0; v < self->l_voices; ++v) {
+		self->voices[v].processor.set_random_seed((uint32_t)self->l_seed + ((uint32_t)v << 16));
+	}
+}
+
+t_max_err parasito_seed_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		self->l_seed = atom_getlong(argv);
+		parasito_seed_voices(self);
+	}
+	return MAX_ERR_NONE;
+}
+
+// The number of voices and threads are fixed once the object exists.
+t_max_err parasito_chans_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		if (self->voices) {
+			object_error((t_object*)self, "@chans can only be set when the object is created");
+		} else {
+			self->l_voices = (long)constrain(atom_getlong(argv), 1, kMaxVoices);
+		}
+	}
+	return MAX_ERR_NONE;
+}
+
+t_max_err parasito_threads_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		if (self->voices) {
+			object_error((t_object*)self, "@threads can only be set when the object is created");
+		} else {
+			self->l_threads = (long)constrain(atom_getlong(argv), 0, kMaxVoices - 1);
+		}
+	}
+	return MAX_ERR_NONE;
+}
+
+t_max_err parasito_parallel_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		if (self->voices) {
+			object_error((t_object*)self, "@parallel can only be set when the object is created");
+		} else {
+			self->l_parallel = atom_getlong(argv) != 0;
+		}
+	}
+	return MAX_ERR_NONE;
+}
+
+t_max_err parasito_spectral_thread_set(t_parasito* self, void* attr, long argc, t_atom* argv) {
+	if (argc && argv) {
+		if (self->voices) {
+			object_error((t_object*)self, "@spectral_thread can only be set when the object is created");
+		} else {
+			self->l_spectral_thread = atom_getlong(argv) != 0;
+		}
+	}
+	return MAX_ERR_NONE;
+}
+
+// Optional argument: 16 keeps the reverb memory in 16-bit like the module,
+// anything else (default) stores it as float. Attributes: @buffer_seconds,
+// @grains, @cpu_budget, @seed, and at creation only @chans, @threads,
+// @parallel and @spectral_thread.
+void* parasito_new(t_symbol* s, long argc, t_atom* argv) {
+	t_parasito* self = (t_parasito*)object_alloc(s == gensym("mc.parasito~") ? mc_class : this_class);
+	outlet_new(self, "multichannelsignal");
+	outlet_new(self, "multichannelsignal");
+	inlet_new(self, NULL);
+
+	dsp_setup((t_pxobject*)self, kNumInlets);
+	self->m_obj.z_misc |= Z_MC_INLETS;
+
+	self->l_voices = 1;
+	self->f_cpu_budget = 0.5;
+	self->cpu_budget.store(self->f_cpu_budget, std::memory_order_relaxed);
+	// Every instance has its own random streams, seeded differently so that
+	// copies of the object do not play the same grains, unless @seed says
+	// otherwise.
+	self->l_seed = 0x21 + instance_count++;
+	live_instances.fetch_add(1, std::memory_order_relaxed);
+	attr_args_process(self, (short)argc, argv);
+	// Parallel mode already keeps the FFTs off the audio thread.
+	if (self->l_parallel) {
+		self->l_spectral_thread = 0;
+	}
+	self->buffer_samplerate = sys_getsr();
+	parasito_buffer_sizes(self, &self->large_buf_size, &self->small_buf_size);
+	size_t stride = self->large_buf_size + self->small_buf_size;
+	self->memory = new uint8_t[stride * self->l_voices];
+
+	clouds::Format reverb_format = clouds::FORMAT_32_BIT;
+	if (attr_args_offset((short)argc, argv) > 0 && atom_getlong(argv) == 16) {
+		reverb_format = clouds::FORMAT_16_BIT;
+	}
+	self->reverb_buf_size = (clouds::Oliverb::memory_size(reverb_format) + 15) & ~(size_t)15;
+	self->reverb_memory = new uint8_t[self->reverb_buf_size * self->l_voices];
+
+	self->voices = new t_parasito_voice[self->l_voices];
+	for (long v = 0; v < self->l_voices; ++v) {
+		t_parasito_voice* voice = &self->voices[v];
+		uint8_t* large_buf = self->memory + v * stride;
+		voice->processor.Init(large_buf, self->large_buf_size,
+			large_buf + self->large_buf_size, self->small_buf_size,
+			self->reverb_memory + v * self->reverb_buf_size, reverb_format);
+		voice->processor.set_max_num_grains(self->l_grains);
+		voice->processor.set_defer_spectral_frames(self->l_spectral_thread != 0);
+		voice->processor.mutable_parameters()->dry_wet = 1.0f;
+		memset(voice->parameter_values, 0, sizeof(voice->parameter_values));
+		voice->parameter_values[clouds::PARAMETER_DRY_WET] = 1.0f;
+		// Starts as a plain reverb, the granular engines are picked with "mode".
+		voice->processor.set_playback_mode(clouds::PLAYBACK_MODE_OLIVERB);
+		voice->processor.Prepare();
+		voice->frames = 0;
+		voice->job_buf = NULL;
+		voice->task.job = parasito_perform_voice;
+		voice->task.context = self;
+		voice->task.index = v;
+		voice->task.done.store(true, std::memory_order_relaxed);
+		voice->task_submitted = false;
+		voice->spectral_task.job = parasito_spectral_voice;
+		voice->spectral_task.context = self;
+		voice->spectral_task.index = v;
+		voice->spectral_task.done.store(true, std::memory_order_relaxed);
+	}
+	parasito_seed_voices(self);
+	// The shared scheduler replaces the object's own threads.
+	if (self->l_parallel || self->l_spectral_thread) {
+		self->scheduler = parasito_scheduler_acquire();
+	}
+	if (!self->l_parallel && self->l_threads) {
+		self->pool = parasito_pool_new(self->l_threads);
+	}
+
+	self->prepare_qelem = qelem_new(self, (method)parasito_prepare);
+	critical_new(&self->queue_lock);
+	self->resync_qelem = qelem_new(self, (method)parasito_resync);
 
 	return (void *)self;
 }
 
 void parasito_free(t_parasito* self) {
 	dsp_free((t_pxobject*)self);
+	live_instances.fetch_sub(1, std::memory_order_relaxed);
+	if (self->scheduler) {
+		parasito_join(self);
+		parasito_join_spectral(self);
+		parasito_scheduler_release(self->scheduler);
+	}
+	parasito_pool_free(self->pool);
+	qelem_free(self->prepare_qelem);
+	qelem_free(self->resync_qelem);
+	critical_free(self->queue_lock);
+	delete[] self->voices;
+	delete[] self->memory;
+	delete[] self->next_memory;
+	delete[] self->reverb_memory;
+	delete[] self->job_memory;
+}
+
+// Both outlets carry one channel per voice.
+long parasito_multichanneloutputs(t_parasito* self, long index) {
+	return self->l_voices;
+}
+
+long parasito_inputchanged(t_parasito* self, long index, long count) {
+	return false;
 }
 
 void parasito_dsp64(t_parasito* self, t_object* dsp64, short* count, double samplerate, long maxvectorsize, long flags) {
+	// Nothing of the voices changes under a task still running.
+	if (self->l_parallel) {
+		parasito_join(self);
+	}
+	for (long v = 0; v < self->l_voices; ++v) {
+		self->voices[v].processor.sample_rate(samplerate);
+	}
+	if (samplerate != self->buffer_samplerate) {
+		self->buffer_samplerate = samplerate;
+		parasito_realloc_buffers(self);
+	}
+
+	long offset = 0;
+	for (int i = 0; i < kNumInlets; ++i) {
+		long channels = (long)(intptr_t)object_method(dsp64, gensym("getnuminputchannels"), self, i);
+		self->inlet_offsets[i] = offset;
+		self->inlet_channels[i] = channels > 0 ? channels : 1;
+		offset += self->inlet_channels[i];
+	}
+
+	// Parameters released by their signal inlet go back to the last message.
+	critical_enter(self->queue_lock);
+	self->num_modulated_inlets = 0;
+	for (int i = 0; i < kNumModulationInlets; ++i) {
+		clouds::ParameterId id = parameter_messages[i].id;
+		bool modulated = count[2 + i] != 0;
+		for (long v = 0; v < self->l_voices; ++v) {
+			t_parasito_voice* voice = &self->voices[v];
+			if (self->parameter_modulated[id] && !modulated &&
+				!voice->processor.QueueParameter(id, voice->parameter_values[id])) {
+				self->parameters_dropped.store(true, std::memory_order_relaxed);
+			}
+		}
+		self->parameter_modulated[id] = modulated;
+		if (modulated) {
+			self->modulated_inlets[self->num_modulated_inlets++] = i;
+		}
+	}
+	critical_exit(self->queue_lock);
+
+	// The voices' copies of the vectors, kept as long as they are big enough.
+	if (self->l_parallel) {
+		if (maxvectorsize > self->job_frames) {
+			delete[] self->job_memory;
+			self->job_frames = maxvectorsize;
+			self->job_memory = new double[(kNumInlets + 2) * self->job_frames * self->l_voices];
+		}
+		std::fill(self->job_memory, self->job_memory + (kNumInlets + 2) * self->job_frames * self->l_voices, 0.0);
+		for (long v = 0; v < self->l_voices; ++v) {
+			self->voices[v].job_buf = self->job_memory + v * (kNumInlets + 2) * self->job_frames;
+			self->voices[v].frames = 0;
+		}
+	}
+
 	object_method_direct(void, (t_object*, t_object*, t_perfroutine64, long, void*),
 						 dsp64, gensym("dsp_add64"), (t_object*)self, (t_perfroutine64)parasito_perform64, 0, NULL);
 }
@@ -116,12 +719,17 @@ void parasito_dsp64(t_parasito* self, t_object* dsp64, short* count, double samp
 void parasito_assist(t_parasito* self, void* unused, t_assist_function io, long index, char* string_dest) {
 	if (io == ASSIST_INLET) {
 		switch (index) {
-			case 1: 
+			case 0: 
 				strncpy(string_dest,"(signal) L IN", ASSIST_STRING_MAXSIZE); 
 				break;
-			case 2: 
+			case 1: 
 				strncpy(string_dest,"(signal) R IN", ASSIST_STRING_MAXSIZE); 
 				break;
+			default:
+				if (index - 2 < kNumModulationInlets) {
+					strncpy(string_dest, parameter_messages[index - 2].assist, ASSIST_STRING_MAXSIZE);
+				}
+				break;
 		}
 	}
 	else if (io == ASSIST_OUTLET) {
@@ -139,89 +747,247 @@ void parasito_assist(t_parasito* self, void* unused, t_assist_function io, long
 void parasito_freeze(t_parasito *x, double f)
 {
   	x->f_freeze = f > 0.5f ? true : false;
-	x->processor.mutable_parameters()->freeze = x->f_freeze;
+	parasito_queue(x, clouds::PARAMETER_FREEZE, x->f_freeze);
 }
 
 void parasito_reverb(t_parasito *x, double f)
 {
   	x->f_reverb = f;
-	x->processor.mutable_parameters()->reverb = constrain(x->f_reverb, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_REVERB, constrain(x->f_reverb, 0.0f, 1.0f));
 }
 
 void parasito_diffusion(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_diffusion = constrain(f, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_DIFFUSION, constrain(f, 0.0f, 1.0f));
 }
 
 void parasito_size(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_size = constrain(f, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_SIZE, constrain(f, 0.0f, 1.0f));
 }
 
 void parasito_mod_rate(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_mod_rate = constrain(f, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_MOD_RATE, constrain(f, 0.0f, 1.0f));
 }
 
 void parasito_mod_amount(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_mod_amount = constrain(f, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_MOD_AMOUNT, constrain(f, 0.0f, 1.0f));
 }
 
 void parasito_ratio(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_ratio = constrain(f, -1.0f, 1.0f) * 12.0f;
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_RATIO, constrain(f, -1.0f, 1.0f) * 12.0f);
 }
 
 void parasito_pitch(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_pitch = f;
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_PITCH, f);
 }
 
 void parasito_density(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_density = constrain(f, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_DENSITY, constrain(f, 0.0f, 1.0f));
 }
 
 void parasito_texture(t_parasito *x, double f)
 {
-	x->processor.mutable_parameters()->oliverb_texture = constrain(f, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_OLIVERB_TEXTURE, constrain(f, 0.0f, 1.0f));
 }
 
 
 void parasito_mix(t_parasito *x, double f)
 {
 	x->f_mix = f;
-	x->processor.mutable_parameters()->dry_wet = constrain(x->f_mix, 0.0f, 1.0f);
+	parasito_queue(x, clouds::PARAMETER_DRY_WET, constrain(x->f_mix, 0.0f, 1.0f));
 }
 
 void parasito_samplerate(t_parasito *x, double f)
 {
-	x->processor.sample_rate(f);
+	for (long v = 0; v < x->l_voices; ++v) {
+		x->voices[v].processor.sample_rate(f);
+	}
+}
+
+// 0 granular, 1 stretch, 2 looping delay, 3 spectral, 4 oliverb only.
+// Switching to or from the spectral mode reallocates the buffers, which
+// happens on the main thread (see parasito_prepare).
+void parasito_mode(t_parasito *x, long n)
+{
+	x->f_mode = constrain(n, 0, clouds::PLAYBACK_MODE_LAST - 1);
+	for (long v = 0; v < x->l_voices; ++v) {
+		x->voices[v].processor.set_playback_mode((clouds::PlaybackMode)(long)x->f_mode);
+	}
+}
+
+void parasito_mono(t_parasito *x, long n)
+{
+	x->f_mono = n != 0;
+	for (long v = 0; v < x->l_voices; ++v) {
+		x->voices[v].processor.set_num_channels(n ? 1 : 2);
+	}
 }
 
+void parasito_lofi(t_parasito *x, long n)
+{
+	x->f_lofi = n != 0;
+	for (long v = 0; v < x->l_voices; ++v) {
+		x->voices[v].processor.set_low_fidelity(n != 0);
+	}
+}
 
+void parasito_position(t_parasito *x, double f)
+{
+	x->f_position = f;
+	parasito_queue(x, clouds::PARAMETER_POSITION, constrain(f, 0.0f, 1.0f));
+}
 
-void ext_main(void* r) {
-	this_class = class_new("parasito~", (method)parasito_new, (method)parasito_free, sizeof(t_parasito), NULL, A_GIMME, 0);
+void parasito_grain_size(t_parasito *x, double f)
+{
+	x->f_size = f;
+	parasito_queue(x, clouds::PARAMETER_SIZE, constrain(f, 0.0f, 1.0f));
+}
+
+// In semitones.
+void parasito_grain_pitch(t_parasito *x, double f)
+{
+	x->f_pitch = f;
+	parasito_queue(x, clouds::PARAMETER_PITCH, constrain(f, -48.0f, 48.0f));
+}
 
-	class_addmethod(this_class,(method) parasito_assist, "assist",	A_CANT,		0);
-	class_addmethod(this_class,(method) parasito_dsp64, "dsp64",	A_CANT,		0);
+void parasito_grain_density(t_parasito *x, double f)
+{
+	x->f_density = f;
+	parasito_queue(x, clouds::PARAMETER_DENSITY, constrain(f, 0.0f, 1.0f));
+}
+
+void parasito_grain_texture(t_parasito *x, double f)
+{
+	x->f_texture = f;
+	parasito_queue(x, clouds::PARAMETER_TEXTURE, constrain(f, 0.0f, 1.0f));
+}
+
+void parasito_spread(t_parasito *x, double f)
+{
+	x->f_spread = f;
+	parasito_queue(x, clouds::PARAMETER_STEREO_SPREAD, constrain(f, 0.0f, 1.0f));
+}
+
+void parasito_feedback(t_parasito *x, double f)
+{
+	x->f_feedback = f;
+	parasito_queue(x, clouds::PARAMETER_FEEDBACK, constrain(f, 0.0f, 1.0f));
+}
+
+void parasito_trigger(t_parasito *x)
+{
+	parasito_queue(x, clouds::PARAMETER_TRIGGER, 1.0);
+}
+
+// setvalue <voice> <parameter> [value]: sends a parameter message to one
+// voice (numbered from 1), or to all of them with voice 0.
+void parasito_setvalue(t_parasito *x, t_symbol* s, long argc, t_atom* argv)
+{
+	if (argc < 2 || atom_gettype(argv + 1) != A_SYM) {
+		object_error((t_object*)x, "setvalue: expected a voice and a parameter");
+		return;
+	}
+	long voice = atom_getlong(argv) - 1;
+	t_symbol* name = atom_getsym(argv + 1);
+	if (voice < -1 || voice >= x->l_voices) {
+		object_error((t_object*)x, "setvalue: no voice %ld", voice + 1);
+		return;
+	}
+	for (int i = 0; i < kNumParameterMessages; ++i) {
+		const t_parameter_message& message = parameter_messages[i];
+		if (name == gensym(message.name)) {
+			double value = argc > 2 ? atom_getfloat(argv + 2) : 1.0;
+			parasito_queue_voice(x, voice, message.id, constrain(value, message.min, message.max) * message.scale);
+			return;
+		}
+	}
+	object_error((t_object*)x, "setvalue: unknown parameter %s", name->s_name);
+}
+
+
+
+// parasito~ and mc.parasito~ are the same object: the mc. name only makes
+// it easier to find, and a package needs "max objectfile mc.parasito~
+// parasito~;" in its init file for Max to find it in this external.
+t_class* parasito_class_new(const char* name) {
+	t_class* c = class_new(name, (method)parasito_new, (method)parasito_free, sizeof(t_parasito), NULL, A_GIMME, 0);
+
+	class_addmethod(c,(method) parasito_assist, "assist",	A_CANT,		0);
+	class_addmethod(c,(method) parasito_dsp64, "dsp64",	A_CANT,		0);
 	
-	class_addmethod(this_class,(method) parasito_reverb, "reverb", A_DEFFLOAT, 0);
-	class_addmethod(this_class,(method) parasito_samplerate, "samplerate", A_DEFFLOAT, 0);
-
-	class_addmethod(this_class,(method) parasito_diffusion, "diffusion", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_size, "size", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_mod_rate, "mod_rate", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_mod_amount, "mod_amount", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_ratio, "ratio", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_pitch, "pitch", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_density, "density", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_texture, "texture", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_freeze, "freeze", A_DEFFLOAT,0);
-	class_addmethod(this_class,(method) parasito_mix, "mix", A_DEFFLOAT,0);
-
-	class_dspinit(this_class);
-	class_register(CLASS_BOX, this_class);
+	class_addmethod(c,(method) parasito_reverb, "reverb", A_DEFFLOAT, 0);
+	class_addmethod(c,(method) parasito_samplerate, "samplerate", A_DEFFLOAT, 0);
+
+	class_addmethod(c,(method) parasito_diffusion, "diffusion", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_size, "size", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_mod_rate, "mod_rate", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_mod_amount, "mod_amount", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_ratio, "ratio", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_pitch, "pitch", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_density, "density", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_texture, "texture", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_freeze, "freeze", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_mix, "mix", A_DEFFLOAT,0);
+
+	class_addmethod(c,(method) parasito_mode, "mode", A_LONG,0);
+	class_addmethod(c,(method) parasito_mono, "mono", A_LONG,0);
+	class_addmethod(c,(method) parasito_lofi, "lofi", A_LONG,0);
+	class_addmethod(c,(method) parasito_position, "position", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_grain_size, "grain_size", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_grain_pitch, "grain_pitch", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_grain_density, "grain_density", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_grain_texture, "grain_texture", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_spread, "spread", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_feedback, "feedback", A_DEFFLOAT,0);
+	class_addmethod(c,(method) parasito_trigger, "bang", 0);
+	class_addmethod(c,(method) parasito_setvalue, "setvalue", A_GIMME, 0);
+	class_addmethod(c,(method) parasito_multichanneloutputs, "multichanneloutputs", A_CANT, 0);
+	class_addmethod(c,(method) parasito_inputchanged, "inputchanged", A_CANT, 0);
+
+	CLASS_ATTR_DOUBLE(c, "buffer_seconds", 0, t_parasito, f_buffer_seconds);
+	CLASS_ATTR_ACCESSORS(c, "buffer_seconds", NULL, parasito_buffer_seconds_set);
+	CLASS_ATTR_LABEL(c, "buffer_seconds", 0, "Recording length (s)");
+
+	CLASS_ATTR_LONG(c, "grains", 0, t_parasito, l_grains);
+	CLASS_ATTR_ACCESSORS(c, "grains", NULL, parasito_grains_set);
+	CLASS_ATTR_LABEL(c, "grains", 0, "Number of grains");
+
+	CLASS_ATTR_DOUBLE(c, "cpu_budget", 0, t_parasito, f_cpu_budget);
+	CLASS_ATTR_ACCESSORS(c, "cpu_budget", NULL, parasito_cpu_budget_set);
+	CLASS_ATTR_LABEL(c, "cpu_budget", 0, "CPU budget");
+
+	CLASS_ATTR_LONG(c, "seed", 0, t_parasito, l_seed);
+	CLASS_ATTR_ACCESSORS(c, "seed", NULL, parasito_seed_set);
+	CLASS_ATTR_LABEL(c, "seed", 0, "Random seed");
+
+	CLASS_ATTR_LONG(c, "chans", 0, t_parasito, l_voices);
+	CLASS_ATTR_ACCESSORS(c, "chans", NULL, parasito_chans_set);
+	CLASS_ATTR_LABEL(c, "chans", 0, "Number of voices");
+
+	CLASS_ATTR_LONG(c, "threads", 0, t_parasito, l_threads);
+	CLASS_ATTR_ACCESSORS(c, "threads", NULL, parasito_threads_set);
+	CLASS_ATTR_LABEL(c, "threads", 0, "Worker threads");
+
+	CLASS_ATTR_LONG(c, "parallel", 0, t_parasito, l_parallel);
+	CLASS_ATTR_ACCESSORS(c, "parallel", NULL, parasito_parallel_set);
+	CLASS_ATTR_STYLE_LABEL(c, "parallel", 0, "onoff", "Render on the shared worker pool");
+
+	CLASS_ATTR_LONG(c, "spectral_thread", 0, t_parasito, l_spectral_thread);
+	CLASS_ATTR_ACCESSORS(c, "spectral_thread", NULL, parasito_spectral_thread_set);
+	CLASS_ATTR_STYLE_LABEL(c, "spectral_thread", 0, "onoff", "Spectral FFTs on the shared worker pool");
+
+	class_dspinit(c);
+	class_register(CLASS_BOX, c);
+	return c;
+}
+
+void ext_main(void* r) {
+	this_class = parasito_class_new("parasito~");
+	mc_class = parasito_class_new("mc.parasito~");
 }
\ No newline at end of file